@@ -0,0 +1,64 @@
+#include "alloc_stats.hh"
+#include <cstdlib>
+#include <new>
+
+static std::atomic<bool> S_counting = false;
+static std::atomic<u64> S_count = 0;
+static std::atomic<u64> S_bytes = 0;
+
+namespace AllocStats
+{
+void
+start ()
+{
+  S_counting.store (true, std::memory_order_relaxed);
+}
+
+u64
+count ()
+{
+  return S_count.load (std::memory_order_relaxed);
+}
+
+u64
+bytes ()
+{
+  return S_bytes.load (std::memory_order_relaxed);
+}
+}
+
+// The other forms of operator new from the standard library forward to this
+// one, except for the over-aligned ones.  Like the one it replaces it calls
+// the new handler until the allocation succeeds or there is none.
+void *
+operator new (std::size_t size)
+{
+  if (S_counting.load (std::memory_order_relaxed))
+    {
+      S_count.fetch_add (1, std::memory_order_relaxed);
+      S_bytes.fetch_add (size, std::memory_order_relaxed);
+    }
+  if (size == 0)
+    size = 1;
+  for (;;)
+    {
+      if (void *const p = std::malloc (size))
+        return p;
+      const std::new_handler handler = std::get_new_handler ();
+      if (!handler)
+        throw std::bad_alloc ();
+      handler ();
+    }
+}
+
+void
+operator delete (void *p) noexcept
+{
+  std::free (p);
+}
+
+void
+operator delete (void *p, std::size_t) noexcept
+{
+  std::free (p);
+}
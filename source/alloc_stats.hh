@@ -0,0 +1,15 @@
+#pragma once
+#include "stdafx.hh"
+
+// Counts the allocations made through the global operator new, reported by
+// the benchmark mode.  Allocations libc makes internally, like the buffers of
+// opendir, are not seen.
+namespace AllocStats
+{
+// Starts counting.  Until then operator new only checks a flag, so runs
+// other than the benchmark do not share counters between threads.
+void start ();
+
+u64 count ();
+u64 bytes ();
+}
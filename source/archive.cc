@@ -0,0 +1,700 @@
+#include "archive.hh"
+#include "mounts.hh"
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace Archive
+{
+struct Member
+{
+  // Relative to the root of the archive, without empty or `.' components
+  std::string path;
+  u64 size;
+  time_t mtime;
+  uid_t uid;
+  gid_t gid;
+  bool is_directory;
+  bool is_symlink;
+};
+
+// Tar file extensions and the program to decompress them with
+struct TarFormat
+{
+  std::string_view suffix;
+  const char *decompressor;
+};
+
+static constexpr std::array<TarFormat, 9> TAR_FORMATS = {{
+  {".tar", nullptr},
+  {".tar.zst", "zstd"},
+  {".tzst", "zstd"},
+  {".tar.gz", "gzip"},
+  {".tgz", "gzip"},
+  {".tar.xz", "xz"},
+  {".txz", "xz"},
+  {".tar.bz2", "bzip2"},
+  {".tbz2", "bzip2"}
+}};
+
+// Central directories and tar extension headers bigger than this are taken
+// to be corrupt rather than read into memory.
+static constexpr u64 MAX_CENTRAL_DIRECTORY = 1ULL << 30;
+static constexpr u64 MAX_EXTENSION_HEADER = 1ULL << 20;
+
+static constexpr usize TAR_BLOCK = 512;
+static constexpr u64 NO_SIZE = std::numeric_limits<u64>::max ();
+
+// Members of the archive read last, which is usually the one being browsed
+static fs::path S_cached;
+static struct stat S_cached_stat;
+static std::vector<Member> S_members;
+
+static std::string
+lower_file_name (const fs::path &path)
+{
+  std::string name = path.filename ().native ();
+  std::transform (name.begin (), name.end (), name.begin (),
+                  [](unsigned char c) { return std::tolower (c); });
+  return name;
+}
+
+// Returns the tar format of the file or nullptr if it is not a tar file.
+static const TarFormat *
+tar_format (const fs::path &path)
+{
+  const std::string name = lower_file_name (path);
+  for (const TarFormat &format : TAR_FORMATS)
+    if (name.ends_with (format.suffix))
+      return &format;
+  return nullptr;
+}
+
+static bool
+is_zip (const fs::path &path)
+{
+  return lower_file_name (path).ends_with (".zip");
+}
+
+bool
+is_archive (const fs::path &path)
+{
+  return is_zip (path) || tar_format (path);
+}
+
+// Returns the archive `path' is in or is itself and stores the path of the
+// member in `inner', or an empty path if it is not in an archive.
+static fs::path
+archive_of (const fs::path &path, fs::path &inner, struct stat &sb)
+{
+  for (fs::path p = path; !p.empty (); p = p.parent_path ())
+    {
+      if (::stat (p.c_str (), &sb) == 0)
+        {
+          if (!S_ISREG (sb.st_mode) || !is_archive (p))
+            break;
+          inner = path.lexically_relative (p);
+          if (inner == ".")
+            inner.clear ();
+          return p;
+        }
+      if (p == p.parent_path ())
+        break;
+    }
+  return {};
+}
+
+bool
+contains (const fs::path &path)
+{
+  fs::path inner;
+  struct stat sb;
+  return !archive_of (path, inner, sb).empty ();
+}
+
+// Drops empty and `.' components, returns an empty string for paths going
+// outside the archive.
+static std::string
+normalize (std::string_view path)
+{
+  std::string result;
+  while (!path.empty ())
+    {
+      const usize slash = path.find ('/');
+      const std::string_view component = path.substr (0, slash);
+      path = slash == path.npos ? std::string_view {} : path.substr (slash + 1);
+      if (component.empty () || component == ".")
+        continue;
+      if (component == "..")
+        return {};
+      if (!result.empty ())
+        result += '/';
+      result += component;
+    }
+  return result;
+}
+
+static void
+add_member (std::vector<Member> &members, Member &&member)
+{
+  member.path = normalize (member.path);
+  if (!member.path.empty ())
+    members.push_back (std::move (member));
+}
+
+static u16
+le16 (const char *p)
+{
+  const u8 *const b = reinterpret_cast<const u8 *> (p);
+  return b[0] | b[1] << 8;
+}
+
+static u32
+le32 (const char *p)
+{
+  return le16 (p) | static_cast<u32> (le16 (p + 2)) << 16;
+}
+
+static u64
+le64 (const char *p)
+{
+  return le32 (p) | static_cast<u64> (le32 (p + 4)) << 32;
+}
+
+static bool
+pread_all (int fd, char *data, usize size, u64 offset)
+{
+  while (size)
+    {
+      const ssize_t n = ::pread (fd, data, size, offset);
+      if (n == -1 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        {
+          if (n == 0)
+            errno = EBADMSG;
+          return false;
+        }
+      data += n;
+      size -= n;
+      offset += n;
+    }
+  return true;
+}
+
+// Converts an MS-DOS date and time in local time.
+static time_t
+dos_time (u16 date, u16 time)
+{
+  struct tm tm {};
+  tm.tm_year = (date >> 9) + 80;
+  tm.tm_mon = ((date >> 5) & 0xf) - 1;
+  tm.tm_mday = date & 0x1f;
+  tm.tm_hour = time >> 11;
+  tm.tm_min = (time >> 5) & 0x3f;
+  tm.tm_sec = (time & 0x1f) * 2;
+  tm.tm_isdst = -1;
+  return std::mktime (&tm);
+}
+
+// Reads the members from the central directory at the end of a zip file,
+// the local headers and the data are never touched.
+static bool
+read_zip (int fd, const struct stat &sb, std::vector<Member> &members)
+{
+  constexpr u32 END_SIGNATURE = 0x06054b50;
+  constexpr u32 ZIP64_LOCATOR_SIGNATURE = 0x07064b50;
+  constexpr u32 ZIP64_END_SIGNATURE = 0x06064b50;
+  constexpr u32 ENTRY_SIGNATURE = 0x02014b50;
+  constexpr usize END_SIZE = 22;
+  constexpr usize ZIP64_LOCATOR_SIZE = 20;
+  constexpr usize ZIP64_END_SIZE = 56;
+  constexpr usize ENTRY_SIZE = 46;
+  constexpr usize MAX_COMMENT = 0xffff;
+
+  // The end record is followed by a comment of up to 64 KiB
+  const u64 file_size = sb.st_size;
+  const usize tail_size = std::min<u64> (file_size, END_SIZE + MAX_COMMENT);
+  std::string tail (tail_size, '\0');
+  if (!pread_all (fd, tail.data (), tail_size, file_size - tail_size))
+    return false;
+  ssize end = static_cast<ssize> (tail_size) - END_SIZE;
+  while (end >= 0 && le32 (tail.data () + end) != END_SIGNATURE)
+    --end;
+  if (end < 0)
+    {
+      errno = EBADMSG;
+      return false;
+    }
+  const char *const record = tail.data () + end;
+  u64 entries = le16 (record + 10);
+  u64 directory_size = le32 (record + 12);
+  u64 directory_offset = le32 (record + 16);
+  if (end >= static_cast<ssize> (ZIP64_LOCATOR_SIZE)
+      && le32 (record - ZIP64_LOCATOR_SIZE) == ZIP64_LOCATOR_SIGNATURE)
+    {
+      char zip64_end[ZIP64_END_SIZE];
+      if (!pread_all (fd, zip64_end, ZIP64_END_SIZE,
+                      le64 (record - ZIP64_LOCATOR_SIZE + 8)))
+        return false;
+      if (le32 (zip64_end) == ZIP64_END_SIGNATURE)
+        {
+          entries = le64 (zip64_end + 32);
+          directory_size = le64 (zip64_end + 40);
+          directory_offset = le64 (zip64_end + 48);
+        }
+    }
+  if (directory_size > MAX_CENTRAL_DIRECTORY
+      || directory_offset + directory_size > file_size)
+    {
+      errno = EBADMSG;
+      return false;
+    }
+  std::string directory (directory_size, '\0');
+  if (!pread_all (fd, directory.data (), directory_size, directory_offset))
+    return false;
+
+  members.reserve (std::min<u64> (entries, directory_size / ENTRY_SIZE));
+  const char *p = directory.data ();
+  const char *const directory_end = p + directory_size;
+  while (directory_end - p >= static_cast<ssize> (ENTRY_SIZE)
+         && le32 (p) == ENTRY_SIGNATURE)
+    {
+      const usize name_length = le16 (p + 28);
+      const usize extra_length = le16 (p + 30);
+      const usize comment_length = le16 (p + 32);
+      const char *const name = p + ENTRY_SIZE;
+      const char *const extra = name + name_length;
+      const char *const next = extra + extra_length + comment_length;
+      if (next > directory_end)
+        break;
+      u64 size = le32 (p + 20);
+      // The real size is in the zip64 extra field, after the uncompressed
+      // size if that did not fit either.
+      if (size == 0xffffffff)
+        for (const char *field = extra;
+             field + 4 <= extra + extra_length
+               && field + 4 + le16 (field + 2) <= extra + extra_length;
+             field += 4 + le16 (field + 2))
+          if (le16 (field) == 0x0001)
+            {
+              const usize at = le32 (p + 24) == 0xffffffff ? 12 : 4;
+              if (at + 8 <= 4U + le16 (field + 2))
+                size = le64 (field + at);
+              break;
+            }
+      const std::string_view path (name, name_length);
+      const mode_t mode = le32 (p + 38) >> 16;
+      add_member (members, {std::string (path), size,
+                            dos_time (le16 (p + 14), le16 (p + 12)),
+                            sb.st_uid, sb.st_gid, path.ends_with ('/'),
+                            S_ISLNK (mode)});
+      p = next;
+    }
+  if (p != directory_end)
+    {
+      errno = EBADMSG;
+      return false;
+    }
+  return true;
+}
+
+// Sequential reads of a tar file, skipping data by seeking if possible.
+class TarStream
+{
+public:
+  TarStream (int fd, bool seekable) : fd_ (fd), seekable_ (seekable) {}
+
+  // Returns false at the end of the stream or on error.
+  bool
+  read (char *data, usize size)
+  {
+    while (size)
+      {
+        const ssize_t n = ::read (fd_, data, size);
+        if (n == -1 && errno == EINTR)
+          continue;
+        if (n <= 0)
+          {
+            error_ = n == 0 ? 0 : errno;
+            return false;
+          }
+        data += n;
+        size -= n;
+      }
+    return true;
+  }
+
+  bool
+  skip (u64 size)
+  {
+    if (seekable_)
+      {
+        if (::lseek (fd_, size, SEEK_CUR) != -1)
+          return true;
+        error_ = errno;
+        return false;
+      }
+    std::array<char, 65536> buffer;
+    while (size)
+      {
+        const usize n = std::min<u64> (size, buffer.size ());
+        if (!read (buffer.data (), n))
+          return false;
+        size -= n;
+      }
+    return true;
+  }
+
+  int error () const { return error_; }
+
+private:
+  int fd_;
+  bool seekable_;
+  int error_ = 0;
+};
+
+// Parses a numeric header field, octal or base-256 for big values.
+static u64
+tar_number (const char *field, usize size)
+{
+  if (static_cast<u8> (field[0]) & 0x80)
+    {
+      u64 value = field[0] & 0x7f;
+      for (usize i = 1; i < size; ++i)
+        value = value << 8 | static_cast<u8> (field[i]);
+      return value;
+    }
+  u64 value = 0;
+  for (usize i = 0; i < size; ++i)
+    {
+      if (field[i] == ' ' && value == 0)
+        continue;
+      if (field[i] < '0' || field[i] > '7')
+        break;
+      value = value * 8 + (field[i] - '0');
+    }
+  return value;
+}
+
+static std::string_view
+tar_string (const char *field, usize size)
+{
+  return {field, ::strnlen (field, size)};
+}
+
+static bool
+valid_tar_checksum (const char *block)
+{
+  u64 sum = 0;
+  s64 signed_sum = 0;
+  for (usize i = 0; i < TAR_BLOCK; ++i)
+    {
+      // The checksum field itself counts as spaces
+      const char c = i >= 148 && i < 156 ? ' ' : block[i];
+      sum += static_cast<u8> (c);
+      signed_sum += static_cast<signed char> (c);
+    }
+  const u64 expected = tar_number (block + 148, 8);
+  return expected == sum || static_cast<s64> (expected) == signed_sum;
+}
+
+// Takes the path and size from the records of a pax extended header, the
+// size stays NO_SIZE if there is none.
+static void
+parse_pax (std::string_view data, std::string &path, u64 &size)
+{
+  while (!data.empty ())
+    {
+      const usize space = data.find (' ');
+      const u64 length = std::strtoull (data.data (), nullptr, 10);
+      if (space == data.npos || length <= space || length > data.size ())
+        return;
+      std::string_view record = data.substr (space + 1, length - space - 1);
+      if (record.ends_with ('\n'))
+        record.remove_suffix (1);
+      const usize equals = record.find ('=');
+      if (equals != record.npos)
+        {
+          const std::string_view key = record.substr (0, equals);
+          const std::string_view value = record.substr (equals + 1);
+          if (key == "path")
+            path = value;
+          else if (key == "size")
+            size = std::strtoull (std::string (value).c_str (), nullptr, 10);
+        }
+      data.remove_prefix (length);
+    }
+}
+
+// Reads the member headers of a tar file and skips over their data.
+static bool
+read_tar (TarStream &in, std::vector<Member> &members)
+{
+  char block[TAR_BLOCK];
+  // Set by GNU long name and pax headers for the member that follows them
+  std::string next_path;
+  u64 next_size = NO_SIZE;
+  while (in.read (block, TAR_BLOCK))
+    {
+      if (std::all_of (block, block + TAR_BLOCK, [](char c) { return !c; }))
+        return true;
+      if (!valid_tar_checksum (block))
+        {
+          errno = EBADMSG;
+          return false;
+        }
+      const char type = block[156];
+      u64 size = tar_number (block + 124, 12);
+      if (type == 'L' || type == 'x' || type == 'g')
+        {
+          if (size > MAX_EXTENSION_HEADER)
+            {
+              errno = EBADMSG;
+              return false;
+            }
+          std::string data ((size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK,
+                            '\0');
+          if (!in.read (data.data (), data.size ()))
+            break;
+          data.resize (size);
+          if (type == 'L')
+            next_path = tar_string (data.data (), data.size ());
+          else if (type == 'x')
+            parse_pax (data, next_path, next_size);
+          continue;
+        }
+      if (next_size != NO_SIZE)
+        size = next_size;
+      Member member {std::move (next_path), 0,
+                     static_cast<time_t> (tar_number (block + 136, 12)),
+                     static_cast<uid_t> (tar_number (block + 108, 8)),
+                     static_cast<gid_t> (tar_number (block + 116, 8)),
+                     type == '5', type == '2'};
+      if (member.path.empty ())
+        {
+          const std::string_view prefix = (tar_string (block + 257, 6)
+                                           == "ustar"
+                                           ? tar_string (block + 345, 155)
+                                           : std::string_view {});
+          if (!prefix.empty ())
+            (member.path = prefix) += '/';
+          member.path += tar_string (block, 100);
+        }
+      // Links and special files have no data
+      if (type == '0' || type == '\0' || type == '7')
+        member.size = size;
+      add_member (members, std::move (member));
+      next_path.clear ();
+      next_size = NO_SIZE;
+      if (!in.skip ((size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK))
+        break;
+    }
+  // A missing end marker is tolerated as long as nothing could not be read
+  errno = in.error ();
+  return !errno;
+}
+
+// Starts `program' decompressing the file open in `fd' into a pipe.  Returns
+// the read end of the pipe or -1 and sets errno on failure.
+static int
+spawn_decompressor (const char *program, int fd, pid_t &pid)
+{
+  int pipe_fds[2];
+  if (::pipe2 (pipe_fds, O_CLOEXEC) == -1)
+    return -1;
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init (&actions);
+  posix_spawn_file_actions_adddup2 (&actions, fd, STDIN_FILENO);
+  posix_spawn_file_actions_adddup2 (&actions, pipe_fds[1], STDOUT_FILENO);
+  // Messages of the decompressor would end up on top of the interface
+  posix_spawn_file_actions_addopen (&actions, STDERR_FILENO, "/dev/null",
+                                    O_WRONLY, 0);
+  char *const argv[] = {const_cast<char *> (program),
+                        const_cast<char *> ("-dc"), nullptr};
+  const int error = ::posix_spawnp (&pid, program, &actions, nullptr, argv,
+                                    environ);
+  posix_spawn_file_actions_destroy (&actions);
+  ::close (pipe_fds[1]);
+  if (error)
+    {
+      ::close (pipe_fds[0]);
+      errno = error;
+      return -1;
+    }
+  return pipe_fds[0];
+}
+
+static bool
+read_compressed_tar (const char *decompressor, int fd,
+                     std::vector<Member> &members)
+{
+  pid_t pid;
+  const int pipe_fd = spawn_decompressor (decompressor, fd, pid);
+  if (pipe_fd == -1)
+    return false;
+  TarStream in (pipe_fd, false);
+  bool ok = read_tar (in, members);
+  int error = errno;
+  // The decompressor gets SIGPIPE if the end marker came before the end of
+  // its output
+  ::close (pipe_fd);
+  int status;
+  while (::waitpid (pid, &status, 0) == -1 && errno == EINTR)
+    ;
+  if (ok && members.empty ()
+      && !(WIFEXITED (status) && WEXITSTATUS (status) == 0))
+    {
+      ok = false;
+      error = EBADMSG;
+    }
+  errno = error;
+  return ok;
+}
+
+static bool
+read_members (const fs::path &archive, const struct stat &sb,
+              std::vector<Member> &members)
+{
+  const int fd = ::open (archive.c_str (), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return false;
+  bool ok;
+  if (is_zip (archive))
+    ok = read_zip (fd, sb, members);
+  else if (const char *const decompressor = tar_format (archive)->decompressor)
+    ok = read_compressed_tar (decompressor, fd, members);
+  else
+    {
+      TarStream in (fd, true);
+      ok = read_tar (in, members);
+    }
+  const int error = errno;
+  ::close (fd);
+  errno = error;
+  return ok;
+}
+
+static struct stat
+member_stat (const Member &member)
+{
+  struct stat sb {};
+  sb.st_mode = (member.is_directory ? S_IFDIR
+                : member.is_symlink ? S_IFLNK : S_IFREG);
+  sb.st_size = member.size;
+  sb.st_mtime = sb.st_atime = member.mtime;
+  sb.st_uid = member.uid;
+  sb.st_gid = member.gid;
+  return sb;
+}
+
+SpaceInfo *
+load (const fs::path &path)
+{
+  fs::path inner;
+  struct stat sb;
+  const fs::path archive = archive_of (path, inner, sb);
+  if (archive.empty ())
+    {
+      G_error = std::make_error_code (std::errc::not_a_directory);
+      return nullptr;
+    }
+  if (G_dirs.contains (path))
+    return &G_dirs[path];
+  if (archive != S_cached || sb.st_mtime != S_cached_stat.st_mtime
+      || sb.st_size != S_cached_stat.st_size)
+    {
+      std::vector<Member> members;
+      if (!read_members (archive, sb, members))
+        {
+          G_error = std::error_code (errno, std::system_category ());
+          return nullptr;
+        }
+      S_members = std::move (members);
+      S_cached = archive;
+      S_cached_stat = sb;
+    }
+
+  // Totals of the subdirectories of `inner', by name
+  struct Directory
+  {
+    u64 size = 0;
+    u64 file_count = 0;
+    struct stat sb {};
+    std::unique_ptr<Summary> summary = std::make_unique<Summary> ();
+  };
+  std::map<std::string_view, Directory> directories;
+  SpaceInfo si;
+  si.add_parent (path.parent_path ());
+  const std::string &prefix = inner.native ();
+  bool found = prefix.empty ();
+  for (const Member &member : S_members)
+    {
+      std::string_view rel = member.path;
+      if (!prefix.empty ())
+        {
+          if (!rel.starts_with (prefix)
+              || (rel.size () > prefix.size () && rel[prefix.size ()] != '/'))
+            continue;
+          if (rel.size () == prefix.size ())
+            {
+              found |= member.is_directory;
+              continue;
+            }
+          found = true;
+          rel.remove_prefix (prefix.size () + 1);
+        }
+      const usize slash = rel.find ('/');
+      const struct stat member_sb = member_stat (member);
+      if (slash == rel.npos && !member.is_directory)
+        {
+          si.add_file (path / rel, member_sb);
+          continue;
+        }
+      const auto [it, inserted] = directories.try_emplace (rel.substr (0,
+                                                                       slash));
+      Directory &directory = it->second;
+      if (inserted)
+        {
+          directory.sb.st_uid = member.uid;
+          directory.sb.st_gid = member.gid;
+        }
+      if (slash == rel.npos)
+        {
+          directory.sb = member_sb;
+          continue;
+        }
+      directory.sb.st_mtime = std::max (directory.sb.st_mtime,
+                                        member_sb.st_mtime);
+      if (member.is_directory)
+        continue;
+      directory.size += member.size;
+      ++directory.file_count;
+      directory.summary->add_file (fs::path (rel).filename ().native (),
+                                   member_sb);
+    }
+  if (!found)
+    {
+      G_error = std::make_error_code (std::errc::no_such_file_or_directory);
+      return nullptr;
+    }
+  for (auto &[name, directory] : directories)
+    {
+      directory.sb.st_mode = S_IFDIR;
+      directory.sb.st_atime = directory.sb.st_mtime;
+      directory.summary->shrink ();
+      si.add (path / name, directory.size, directory.file_count, true,
+              nullptr, std::move (directory.summary), &directory.sb);
+    }
+  file_system_free = Mounts::free_space (archive.parent_path ());
+  return &G_dirs.insert_or_assign (path, std::move (si)).first->second;
+}
+
+void
+invalidate ()
+{
+  S_cached.clear ();
+  S_members.clear ();
+}
+}
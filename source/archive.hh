@@ -0,0 +1,26 @@
+#pragma once
+#include "stdafx.hh"
+#include "space_info.hh"
+
+// Browsing the members of archives as if they were directories, without
+// extracting them.  Zip files are listed from their central directory, tar
+// files by reading only the member headers and seeking over the data.
+// Compressed tar files are piped through the matching decompressor, so their
+// data has to be read but is never written anywhere.
+namespace Archive
+{
+// Returns whether the file name has the extension of a supported archive.
+bool is_archive (const fs::path &path);
+
+// Returns whether `path' is an archive or a path inside one.
+bool contains (const fs::path &path);
+
+// Lists the directory inside an archive at `path', or the top level of the
+// archive if `path' is the archive itself, and caches it in `G_dirs'.  Zip
+// members count with their compressed size, so the sizes add up to the size
+// of the archive.  Returns nullptr and sets `G_error' on error.
+SpaceInfo * load (const fs::path &path);
+
+// Forgets the cached members so the next `load' reads the archive again.
+void invalidate ();
+}
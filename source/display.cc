@@ -1,7 +1,19 @@
 #include "display.hh"
 #include "options.hh"
 #include "select.hh"
+#include "input.hh"
+#include "remove.hh"
+#include "scheduler.hh"
+#include "throttle.hh"
+#include "mounts.hh"
 #include <ncurses.h>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <thread>
+#include <unistd.h>
 
 constexpr int SELECTION_COLOR = 10;
 
@@ -10,11 +22,23 @@ static usize S_cursor;
 
 static const SpaceInfo *S_si;
 static fs::path S_current_path;
+static u32 S_cold_days;
 
 static int S_display_width;
 static int S_display_height;
 static int S_page_move_amount;
 
+// With -low-bandwidth ncurses writes to a pseudo terminal, and a thread
+// forwards everything to the real one and counts the bytes.
+static int S_pty_master = -1;
+static FILE *S_pty_out;
+static std::thread S_forwarder;
+static std::atomic<u64> S_bytes_sent;
+// Modes of the real terminal before the screen was set up, ncurses only sets
+// up the pseudo terminal.
+static struct termios S_tty_modes;
+static struct sigaction S_curses_winch;
+
 namespace Display
 {
 
@@ -36,11 +60,132 @@ bar (f64 fullness, int length, char fill='#', char empty=' ')
   print_n (empty, length - fill_amount);
 }
 
+// Bar for an estimated value, the range of its margin of error is drawn with
+// `range'.
+static inline void
+bar (f64 low, f64 high, int length, char range)
+{
+  auto print_n = [](char c, unsigned n) {
+    while (n--)
+      addch (c);
+  };
+  const int low_amount = std::lround (std::clamp (low, 0.0, 1.0) * length);
+  const int high_amount = std::lround (std::clamp (high, 0.0, 1.0) * length);
+  print_n ('#', low_amount);
+  print_n (range, high_amount - low_amount);
+  print_n (' ', length - high_amount);
+}
+
+// Forwards the output waiting on the pseudo terminal, for up to `wait_ms'
+// after the last of it.  Returns false once the other side is closed.
+static bool
+forward_output (int wait_ms)
+{
+  char buffer[4096];
+  pollfd pfd {S_pty_master, POLLIN, 0};
+  while (::poll (&pfd, 1, wait_ms) != 0)
+    {
+      const ssize_t n = ::read (S_pty_master, buffer, sizeof (buffer));
+      if (n == -1 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return false;
+      S_bytes_sent += n;
+      for (ssize_t done = 0; done < n;)
+        {
+          const ssize_t w = ::write (STDOUT_FILENO, buffer + done, n - done);
+          if (w == -1 && errno != EINTR)
+            return false;
+          done += std::max<ssize_t> (w, 0);
+        }
+    }
+  return true;
+}
+
+// Gives the pseudo terminal the size of the real one, then lets ncurses
+// handle the resize.
+static void
+resized (int sig)
+{
+  struct winsize ws;
+  if (::ioctl (STDOUT_FILENO, TIOCGWINSZ, &ws) == 0)
+    ::ioctl (::fileno (S_pty_out), TIOCSWINSZ, &ws);
+  if (S_curses_winch.sa_handler != SIG_DFL
+      && S_curses_winch.sa_handler != SIG_IGN)
+    S_curses_winch.sa_handler (sig);
+}
+
+// Ends the screen like ncurses does on an interrupt, but forwards its last
+// output and puts the real terminal back before exiting.
+static void
+interrupted (int)
+{
+  endwin ();
+  std::fflush (S_pty_out);
+  forward_output (50);
+  ::tcsetattr (STDIN_FILENO, TCSADRAIN, &S_tty_modes);
+  ::_exit (1);
+}
+
+// Opens the pseudo terminal for ncurses to write to with the size and modes
+// of the real one.  Returns false if there is no real terminal or no pseudo
+// terminal.
+static bool
+open_counted_output ()
+{
+  struct winsize ws;
+  if (!::isatty (STDIN_FILENO) || ::tcgetattr (STDIN_FILENO, &S_tty_modes) == -1
+      || ::ioctl (STDOUT_FILENO, TIOCGWINSZ, &ws) == -1)
+    return false;
+  S_pty_master = ::posix_openpt (O_RDWR | O_NOCTTY | O_CLOEXEC);
+  const char *const name = (S_pty_master != -1 && ::grantpt (S_pty_master) == 0
+                            && ::unlockpt (S_pty_master) == 0
+                            ? ::ptsname (S_pty_master) : nullptr);
+  const int slave = name ? ::open (name, O_RDWR | O_NOCTTY | O_CLOEXEC) : -1;
+  if (slave == -1 || !(S_pty_out = ::fdopen (slave, "w")))
+    {
+      if (slave != -1)
+        ::close (slave);
+      if (S_pty_master != -1)
+        ::close (S_pty_master);
+      S_pty_master = -1;
+      return false;
+    }
+  // The output is processed once, by the pseudo terminal with the settings
+  // ncurses sees
+  ::tcsetattr (slave, TCSANOW, &S_tty_modes);
+  ::ioctl (slave, TIOCSWINSZ, &ws);
+  struct termios modes = S_tty_modes;
+  modes.c_lflag &= ~(ICANON | ECHO);
+  modes.c_lflag |= ISIG;
+  modes.c_iflag &= ~ICRNL;
+  modes.c_oflag &= ~OPOST;
+  modes.c_cc[VMIN] = 1;
+  modes.c_cc[VTIME] = 0;
+  ::tcsetattr (STDIN_FILENO, TCSADRAIN, &modes);
+  S_forwarder = std::thread ([] {
+    while (forward_output (-1))
+      ;
+  });
+  return true;
+}
+
 void
 begin ()
 {
   setlocale (LC_CTYPE, "");
-  initscr ();
+  if (Options::low_bandwidth && open_counted_output ())
+    {
+      newterm (nullptr, S_pty_out, stdin);
+      struct sigaction action {};
+      action.sa_handler = resized;
+      ::sigaction (SIGWINCH, &action, &S_curses_winch);
+      action.sa_handler = interrupted;
+      ::sigaction (SIGINT, &action, nullptr);
+      ::sigaction (SIGTERM, &action, nullptr);
+    }
+  else
+    initscr ();
   curs_set (0);
   noecho ();
   cbreak ();
@@ -49,6 +194,10 @@ begin ()
   use_default_colors ();
 
   init_pair (SELECTION_COLOR, COLOR_BLACK, COLOR_YELLOW);
+  // ncurses only sends the cells that changed and scrolls the list with
+  // scroll regions, this lets it use insert/delete line as well.
+  if (Options::low_bandwidth)
+    idlok (stdscr, TRUE);
 
   refresh_size ();
   S_bar.assign (S_display_width, ' ');
@@ -58,6 +207,18 @@ void
 end ()
 {
   endwin ();
+  if (S_pty_out)
+    {
+      // The forwarder stops once the pseudo terminal is closed and it has
+      // sent the rest
+      std::signal (SIGINT, SIG_DFL);
+      std::signal (SIGTERM, SIG_DFL);
+      std::fclose (S_pty_out);
+      S_pty_out = nullptr;
+      S_forwarder.join ();
+      ::close (S_pty_master);
+      ::tcsetattr (STDIN_FILENO, TCSADRAIN, &S_tty_modes);
+    }
 }
 
 int
@@ -92,16 +253,25 @@ page_move_amount ()
   return S_page_move_amount;
 }
 
+static void print_bytes_sent ();
+
 void
 refresh ()
 {
+  if (S_pty_out)
+    print_bytes_sent ();
   ::refresh ();
 }
 
 void
 clear ()
 {
-  ::clear ();
+  // Clearing makes ncurses send the whole screen again, erasing only sends
+  // what differs from it after redrawing.
+  if (Options::low_bandwidth)
+    ::erase ();
+  else
+    ::clear ();
 }
 
 void
@@ -110,6 +280,12 @@ set_space_info (const SpaceInfo *si)
   S_si = si;
 }
 
+void
+set_cold_days (u32 days)
+{
+  S_cold_days = days;
+}
+
 void
 set_path (const fs::path &path)
 {
@@ -201,13 +377,35 @@ print_size (u64 size, int width = 0)
   return 0;
 }
 
+// Shows how many bytes went to the terminal before this frame at the right
+// end of the header.
+static void
+print_bytes_sent ()
+{
+  const u64 sent = S_bytes_sent;
+  attron (A_REVERSE);
+  move (0, S_display_width - print_size<true> (sent) - 7);
+  addch (' ');
+  print_size (sent);
+  addstr (" sent ");
+  attroff (A_REVERSE);
+}
+
+// Returns the size shown for the item, this depends on whether the cold
+// data view is active.
+static u64
+item_size (const SpaceInfo &si, const SpaceInfo::value_type &item)
+{
+  return S_cold_days ? si.cold_bytes (item, S_cold_days) : item.size;
+}
+
 static int
 size_column_width (const SpaceInfo &si)
 {
-  auto get_width = [](const SpaceInfo::value_type &item) {
+  auto get_width = [&si](const SpaceInfo::value_type &item) {
     return (item.error
             ? std::max (0, static_cast<int> (strlen (item.error)) - (Options::bar_length + 2))
-            : print_size<true> (item.size));
+            : print_size<true> (item_size (si, item)));
   };
   auto compare = [&get_width](const SpaceInfo::value_type &a,
                               const SpaceInfo::value_type &b) {
@@ -218,7 +416,7 @@ size_column_width (const SpaceInfo &si)
 
 static void
 print_item (const SpaceInfo &si, usize idx, int row, int size_width,
-            bool highlight, bool do_highlight)
+            u64 biggest, bool highlight, bool do_highlight)
 {
   const SpaceInfo::value_type &item = si[idx];
   const bool is_selected = do_highlight ? Select::is_selected (idx) : false;
@@ -237,15 +435,41 @@ print_item (const SpaceInfo &si, usize idx, int row, int size_width,
         {
           printw ("%-*s", size_width + Options::bar_length + 3, item.error);
         }
+      else if (Remove::busy () && Remove::in_progress (S_current_path / item.path))
+        {
+          printw ("%-*s", size_width + Options::bar_length + 3, "Deleting");
+        }
       else
         {
-          print_size (item.size, size_width);
+          const u64 size = item_size (si, item);
+          // Sizes that are still being computed or whose scan was stopped
+          // are lower bounds, they are dimmed and get a different bar.
+          const char fill = item.partial ? '~' : '#';
+          if (item.partial && !highlight)
+            attron (A_DIM);
+          print_size (size, size_width);
           addch (' ');
           addch ('[');
-          bar (si.size_relative_to_biggest (item), Options::bar_length);
+          if (S_cold_days)
+            bar (biggest ? static_cast<f64> (size) / biggest : 0.0,
+                 Options::bar_length, fill);
+          else if (item.margin && si.biggest ())
+            bar (static_cast<f64> (item.size - std::min (item.size, item.margin))
+                   / si.biggest (),
+                 static_cast<f64> (item.size + item.margin) / si.biggest (),
+                 Options::bar_length, '-');
+          else
+            bar (si.size_relative_to_biggest (item), Options::bar_length, fill);
           addch (']');
+          if (item.partial && !highlight)
+            attroff (A_DIM);
         }
-      addch (' ');
+      // Directories with unreadable entries get a badge, their size is a
+      // lower bound.
+      if (item.unreadable)
+        addch ('!' | A_BOLD);
+      else
+        addch (' ');
       if constexpr (std::is_same_v<fs::path::value_type, char>)
         addstr (item.path.c_str ());
       else
@@ -263,44 +487,106 @@ static void
 print_items (const SpaceInfo &si, usize from, usize to, int size_width,
              bool cursor)
 {
+  u64 biggest = si.biggest ();
+  if (S_cold_days)
+    {
+      biggest = 0;
+      for (const auto &item : si)
+        biggest = std::max (biggest, item_size (si, item));
+    }
   usize row = 1;
   for (usize i = from; i <= to; ++i, ++row)
     {
-      print_item (si, i, row, size_width, cursor && (i == S_cursor), cursor);
+      print_item (si, i, row, size_width, biggest,
+                  cursor && (i == S_cursor), cursor);
     }
 }
 
-void
-space_info (bool show_cursor)
+// Returns the first and last index of the items that are visible with the
+// cursor at the given position.
+static std::pair<usize, usize>
+visible_range (usize cursor, usize last_index)
 {
   const usize rows = static_cast<usize> (S_display_height - 3);
   const usize rows_2 = static_cast<usize> (rows / 2);
-  const usize item_count = S_si->item_count ();
+
+  if (last_index <= rows)
+    return {0, last_index};
+  else if (cursor < rows_2)
+    return {0, rows};
+  else if (cursor >= (last_index - rows_2))
+    return {last_index - rows, last_index};
+  else
+    return {cursor - rows_2, cursor + (rows - rows_2)};
+}
+
+void
+space_info (bool show_cursor)
+{
   const int size_width = size_column_width (*S_si);
-  int first, last;
+  const auto [first, last] = visible_range (S_cursor, S_si->item_count ());
+  print_items (*S_si, first, last, size_width, show_cursor);
+}
 
-  if (item_count <= rows)
-    {
-      first = 0;
-      last = item_count;
-    }
-  else if (S_cursor < rows_2)
-    {
-      first = 0;
-      last = rows;
-    }
-  else if (S_cursor >= (item_count - rows_2))
+// Where the scan of the current directory started, to tell how much of it
+// is done if it is the root of a file system.
+static struct
+{
+  fs::path path;
+  // Used inodes of the file system
+  u64 total;
+  std::chrono::steady_clock::time_point start;
+  u64 start_entries;
+} S_scan;
+
+static void
+print_scan_progress ()
+{
+  using Clock = std::chrono::steady_clock;
+  const u64 done = Scheduler::entries (S_current_path);
+  if (S_scan.path != S_current_path || done < S_scan.start_entries)
     {
-      first = item_count - rows;
-      last = item_count;
+      S_scan.path = S_current_path;
+      S_scan.total = Mounts::root_used_inodes (S_current_path);
+      S_scan.start = Clock::now ();
+      S_scan.start_entries = done;
     }
+  if (S_scan.total == 0)
+    return;
+  // Hard links and file systems mounted below the root make the number of
+  // entries overshoot the number of inodes, so never claim to be done.
+  const f64 fraction = std::min (0.99, static_cast<f64> (done) / S_scan.total);
+  printw (", %.0f%%", fraction * 100.0);
+  const f64 seconds
+    = std::chrono::duration<f64> (Clock::now () - S_scan.start).count ();
+  const u64 entries = done - S_scan.start_entries;
+  if (seconds < 1.0 || entries == 0 || done >= S_scan.total)
+    return;
+  const u64 eta = static_cast<u64> ((S_scan.total - done) * seconds / entries);
+  if (eta >= 3600)
+    printw (" ETA %" PRIu64 "h%02" PRIu64 "m", eta / 3600, eta / 60 % 60);
   else
+    printw (" ETA %" PRIu64 "m%02" PRIu64 "s", eta / 60, eta % 60);
+}
+
+static void
+print_device_rates ()
+{
+  // More would not fit next to everything else
+  constexpr usize MAX_DEVICES = 3;
+  const std::vector<Scheduler::DeviceStats> devices = Scheduler::devices ();
+  for (usize i = 0; i < std::min (devices.size (), MAX_DEVICES); ++i)
     {
-      first = S_cursor - rows_2;
-      last = S_cursor + (rows - rows_2);
+      const f64 rate = devices[i].rate;
+      printw (i ? ", %s " : " [%s ",
+              Mounts::device_name (devices[i].dev).c_str ());
+      if (rate >= 1000.0)
+        printw ("%.1fk/s", rate / 1000.0);
+      else
+        printw ("%.0f/s", rate);
     }
-
-  print_items (*S_si, first, last, size_width, show_cursor);
+  if (!devices.empty ())
+    addch (']');
 }
 
 void
@@ -311,11 +597,68 @@ footer ()
   attron (A_REVERSE);
   fill_line (row);
   mvaddstr (row, 0, "Total disk usage: ");
+  const u64 margin = S_si->total_margin ();
+  if (S_si->is_lower_bound ())
+    addstr ("at least ");
+  else if (margin)
+    addstr ("about ");
   print_size (S_si->total ());
+  if (margin)
+    {
+      addstr (" +/- ");
+      print_size (margin);
+    }
+  if (S_cold_days)
+    {
+      addstr (" (");
+      print_size (S_si->summary ().idle.bytes_older_than (S_cold_days));
+      printw (" unused for %" PRIu32 " days)", S_cold_days);
+    }
+  // Nothing gets checked on file systems without FIEMAP
+  if (const ExtentUsage &extents = S_si->summary ().extents; extents.files)
+    {
+      addstr (" (");
+      print_size (extents.exclusive);
+      addstr (" exclusive, ");
+      print_size (extents.shared);
+      addstr (" shared)");
+    }
   printw (", %" PRIu64 " Items, %" PRIu64 " Files total, ",
           S_si->item_count (), S_si->total_file_count ());
   print_size (file_system_free);
   addstr (" Free");
+  if (S_si->partial_count ())
+    {
+      const bool busy = Scheduler::busy (S_current_path);
+      printw (", %s %" PRIu64 " dirs", busy ? "sizing" : "incomplete",
+              S_si->partial_count ());
+      if (busy)
+        {
+          print_scan_progress ();
+          print_device_rates ();
+        }
+    }
+  else if (Options::estimate && Scheduler::busy (S_current_path))
+    addstr (", estimating");
+  if (const f64 rate = Throttle::rate ();
+      rate && Scheduler::busy (S_current_path))
+    printw (" (throttled to %.0f/s)", rate);
+  switch (S_si->sort_key ())
+    {
+      break; case SortKey::Name: addstr (", by name");
+      break; case SortKey::FileCount: addstr (", by file count");
+      break; case SortKey::Modified: addstr (", by modification time");
+      break; default: break;
+    }
+  if (S_si->unreadable_count ())
+    printw (", %" PRIu64 " unreadable (%s)", S_si->unreadable_count (),
+            std::strerror (S_si->read_error ()));
+  if (Remove::busy ())
+    {
+      addstr (", deleting (");
+      print_size (Remove::progress ());
+      addstr (" freed)");
+    }
   move (row, S_display_width - sizeof (help_info));
   addstr (help_info);
   attroff (A_REVERSE);
@@ -352,6 +695,12 @@ set_cursor (usize to)
   S_cursor = to;
 }
 
+usize
+cursor ()
+{
+  return S_cursor;
+}
+
 fs::path
 select (const SpaceInfo &from, const fs::path &current)
 {
@@ -361,4 +710,99 @@ select (const SpaceInfo &from, const fs::path &current)
   return current / p;
 }
 
+static void
+print_report_row (const ReportRow &row, int line, u64 biggest,
+                  int size_width, int count_width, bool highlight)
+{
+  if (highlight)
+    attron (A_REVERSE);
+  fill_line (line);
+  move (line, 0);
+  addch (' ');
+  print_size (row.size, size_width);
+  addstr (" [");
+  if (row.fraction >= 0.0)
+    bar (row.fraction, Options::bar_length);
+  else
+    bar (biggest ? static_cast<f64> (row.size) / biggest : 1.0,
+         Options::bar_length);
+  printw ("] %*" PRIu64 " ", count_width, row.count);
+  addstr (row.label.c_str ());
+  if (highlight)
+    attroff (A_REVERSE);
+}
+
+ssize
+report (const std::string &title, const std::vector<ReportRow> &rows)
+{
+  constexpr const char help_info[] = "Enter: select, any other key: close";
+  usize cursor = 0;
+  u64 biggest = 0;
+  int size_width = 0;
+  int count_width = 0;
+  for (const ReportRow &row : rows)
+    {
+      biggest = std::max (biggest, row.size);
+      size_width = std::max (size_width, print_size<true> (row.size));
+      count_width = std::max (count_width, number_length (row.count));
+    }
+  for (;;)
+    {
+      clear ();
+      attron (A_REVERSE);
+      fill_line (0);
+      mvaddstr (0, 0, title.c_str ());
+      fill_line (S_display_height - 1);
+      mvaddstr (S_display_height - 1, 0, help_info);
+      attroff (A_REVERSE);
+      if (rows.empty ())
+        mvaddstr (1, 1, "Nothing to show");
+      else
+        {
+          const auto [first, last] = visible_range (cursor, rows.size () - 1);
+          for (usize i = first; i <= last; ++i)
+            print_report_row (rows[i], 1 + i - first, biggest, size_width,
+                              count_width, i == cursor);
+        }
+      ::refresh ();
+      switch (Input::get_char ())
+        {
+          case KEY_UP:
+          case 'k':
+            cursor -= cursor > 0;
+            break;
+          case KEY_DOWN:
+          case 'j':
+            cursor += cursor + 1 < rows.size ();
+            break;
+          case KEY_PPAGE:
+          case 'K':
+            cursor -= std::min<usize> (cursor, S_page_move_amount);
+            break;
+          case KEY_NPAGE:
+          case 'J':
+            cursor = std::min<usize> (cursor + S_page_move_amount,
+                                      rows.empty () ? 0 : rows.size () - 1);
+            break;
+          case KEY_HOME:
+          case 'g':
+            cursor = 0;
+            break;
+          case KEY_END:
+          case 'G':
+            cursor = rows.empty () ? 0 : rows.size () - 1;
+            break;
+          case KEY_RESIZE:
+            refresh_size ();
+            break;
+          case 10: // Enter
+            if (!rows.empty ())
+              return cursor;
+            return -1;
+          default:
+            return -1;
+        }
+    }
+}
+
 }
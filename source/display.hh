@@ -1,9 +1,21 @@
 #pragma once
 #include "stdafx.hh"
+#include <ncurses.h>
 #include "space_info.hh"
 
 namespace Display
 {
+// A row in a report view.
+struct ReportRow
+{
+  std::string label;
+  u64 size;
+  u64 count;
+  // Fill of the bar, if negative it shows the size relative to the biggest
+  // row.
+  f64 fraction = -1.0;
+};
+
 void begin ();
 void end ();
 
@@ -18,6 +30,9 @@ void clear ();
 
 void set_space_info (const SpaceInfo *);
 void set_path (const fs::path &path);
+// Show the bytes not modified or accessed in the given number of days
+// instead of the total size, 0 to show the total size.
+void set_cold_days (u32 days);
 
 void header ();
 void space_info (bool show_cursor = true);
@@ -26,5 +41,11 @@ void format_footer (const char *fmt, ...);
 
 void move_cursor (ssize by);
 void set_cursor (usize to);
+usize cursor ();
 fs::path select (const SpaceInfo &from, const fs::path &current);
+
+// Shows the given rows in a scrollable list until a key other than a
+// movement key is pressed.  Returns the index of the row that was chosen
+// with Enter, or -1 if the view was closed otherwise.
+ssize report (const std::string &title, const std::vector<ReportRow> &rows);
 }
@@ -0,0 +1,387 @@
+#include "duplicates.hh"
+#include "options.hh"
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace Duplicates
+{
+struct Candidate
+{
+  fs::path path;
+  // Hash of the first and last block
+  u64 hash[2];
+};
+
+struct Inode
+{
+  dev_t dev;
+  ino_t ino;
+
+  bool operator== (const Inode &) const = default;
+};
+
+struct InodeHash
+{
+  usize
+  operator() (const Inode &i) const
+  { return std::hash<u64> {} ((static_cast<u64> (i.dev) << 40) ^ i.ino); }
+};
+
+// Size of the blocks at the start and end of the file used for the partial
+// hash.
+constexpr usize PARTIAL_BLOCK = 4096;
+// Bytes compared per file at a time, less for big groups but never less than
+// MIN_COMPARE_BLOCK.
+constexpr usize READ_BLOCK = 1 << 20;
+constexpr usize MIN_COMPARE_BLOCK = 64 << 10;
+// Files of a group kept open while comparing, the others are opened for
+// every block.
+constexpr usize MAX_OPEN_FILES = 32;
+
+struct Recorded
+{
+  fs::path path;
+  Inode inode;
+};
+
+static std::unordered_map<u64, std::vector<Recorded>> S_by_size;
+static std::unordered_set<Inode, InodeHash> S_seen;
+// Files get recorded by the scanner threads
+static std::mutex S_mutex;
+
+void
+record (const fs::path &path, const struct stat &sb)
+{
+  if (static_cast<u64> (sb.st_size) < Options::duplicates_min_size * 1024ULL
+      || sb.st_size == 0)
+    return;
+  std::lock_guard lock (S_mutex);
+  const Inode inode {sb.st_dev, sb.st_ino};
+  if (!S_seen.insert (inode).second)
+    return;
+  S_by_size[sb.st_size].emplace_back (path, inode);
+}
+
+static bool is_below (const fs::path &path, const fs::path &dir);
+
+void
+forget (const fs::path &path, bool missing_only)
+{
+  struct stat sb;
+  std::lock_guard lock (S_mutex);
+  for (auto it = S_by_size.begin (); it != S_by_size.end ();)
+    {
+      std::erase_if (it->second, [&](const Recorded &r) {
+        if (!is_below (r.path, path)
+            || (missing_only && ::lstat (r.path.c_str (), &sb) == 0))
+          return false;
+        S_seen.erase (r.inode);
+        return true;
+      });
+      if (it->second.empty ())
+        it = S_by_size.erase (it);
+      else
+        ++it;
+    }
+}
+
+// Incremental 128-bit hash, the two lanes use different seeds and
+// multipliers.
+class Hasher
+{
+public:
+  void
+  update (const u8 *data, usize size)
+  {
+    u64 word;
+    for (; size >= 8; data += 8, size -= 8)
+      {
+        std::memcpy (&word, data, 8);
+        mix (word);
+      }
+    if (size)
+      {
+        word = 0;
+        std::memcpy (&word, data, size);
+        mix (word ^ (static_cast<u64> (size) << 56));
+      }
+  }
+
+  std::pair<u64, u64>
+  digest () const
+  { return {finalize (a_), finalize (b_)}; }
+
+private:
+  void
+  mix (u64 word)
+  {
+    a_ = std::rotl ((a_ ^ word) * 0x9e3779b97f4a7c15ULL, 31);
+    b_ = std::rotl ((b_ + word) * 0xc2b2ae3d27d4eb4fULL, 27) ^ word;
+  }
+
+  static u64
+  finalize (u64 h)
+  {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    return h ^ (h >> 33);
+  }
+
+  u64 a_ = 0x243f6a8885a308d3ULL;
+  u64 b_ = 0x13198a2e03707344ULL;
+};
+
+// Hashes the first and last block of the file.  Returns false if the file
+// could not be read.
+static bool
+partial_hash (Candidate &c, u64 size)
+{
+  constexpr ssize_t block = PARTIAL_BLOCK;
+  u8 buf[2 * PARTIAL_BLOCK];
+  const int fd = ::open (c.path.c_str (), O_RDONLY | O_NOFOLLOW);
+  if (fd == -1)
+    return false;
+  const usize len = std::min<u64> (size, sizeof (buf));
+  bool ok;
+  if (size <= sizeof (buf))
+    ok = ::pread (fd, buf, len, 0) == static_cast<ssize_t> (len);
+  else
+    ok = (::pread (fd, buf, block, 0) == block
+          && ::pread (fd, buf + block, block, size - block) == block);
+  ::close (fd);
+  if (!ok)
+    return false;
+  Hasher h;
+  h.update (buf, len);
+  std::tie (c.hash[0], c.hash[1]) = h.digest ();
+  return true;
+}
+
+// Calls `f' for every index in [0, count) using all available cores.
+template <class Function>
+static void
+parallel_for (usize count, Function f)
+{
+  const usize n_threads = std::min<usize> (
+    std::max (1U, std::thread::hardware_concurrency ()), count);
+  std::atomic<usize> next = 0;
+  std::vector<std::thread> threads;
+  threads.reserve (n_threads);
+  for (usize t = 0; t < n_threads; ++t)
+    threads.emplace_back ([&]() {
+      for (usize i; (i = next++) < count;)
+        f (i);
+    });
+  for (std::thread &t : threads)
+    t.join ();
+}
+
+// A set of files of equal size which may be identical.
+struct Bucket
+{
+  u64 size;
+  std::vector<Candidate *> files;
+};
+
+// Hashes every file in the buckets and splits them into buckets of files
+// with equal hashes, dropping files without any potential duplicates.
+template <class HashFunction>
+static std::vector<Bucket>
+refine (std::vector<Bucket> &buckets, HashFunction hash)
+{
+  std::vector<std::pair<Candidate *, u64>> work;
+  for (const Bucket &b : buckets)
+    for (Candidate *c : b.files)
+      work.emplace_back (c, b.size);
+  std::vector<char> ok (work.size ());
+  parallel_for (work.size (), [&](usize i) {
+    ok[i] = hash (*work[i].first, work[i].second);
+  });
+
+  std::vector<Bucket> result;
+  usize w = 0;
+  for (Bucket &b : buckets)
+    {
+      std::vector<Candidate *> files;
+      for (Candidate *c : b.files)
+        if (ok[w++])
+          files.push_back (c);
+      std::sort (files.begin (), files.end (),
+                 [](const Candidate *x, const Candidate *y) {
+                   return (x->hash[0] == y->hash[0]
+                           ? x->hash[1] < y->hash[1]
+                           : x->hash[0] < y->hash[0]);
+                 });
+      for (auto first = files.begin (); first != files.end ();)
+        {
+          auto last = std::find_if (first, files.end (),
+                                    [first](const Candidate *c) {
+                                      return (c->hash[0] != (*first)->hash[0]
+                                              || c->hash[1] != (*first)->hash[1]);
+                                    });
+          if (last - first > 1)
+            result.emplace_back (b.size, std::vector<Candidate *> (first, last));
+          first = last;
+        }
+    }
+  return result;
+}
+
+// A file of a bucket being compared, with its last block read.
+struct Member
+{
+  Candidate *file;
+  int fd;
+  std::vector<u8> data;
+};
+
+// Reads `len' bytes at `offset' into `m.data', opening the file if it is not
+// kept open.
+static bool
+read_block (Member &m, u64 offset, usize len)
+{
+  m.data.resize (len);
+  const int fd = (m.fd != -1 ? m.fd
+                  : ::open (m.file->path.c_str (), O_RDONLY | O_NOFOLLOW));
+  if (fd == -1)
+    return false;
+  const bool ok = ::pread (fd, m.data.data (), len, offset)
+                  == static_cast<ssize_t> (len);
+  if (fd != m.fd)
+    ::close (fd);
+  return ok;
+}
+
+// Splits the bucket into groups of files with equal contents.  All files
+// are read side by side a block at a time, so each is read once however
+// many copies it has.
+static std::vector<Bucket>
+confirm_bucket (const Bucket &bucket)
+{
+  const usize block = std::clamp (READ_BLOCK / bucket.files.size (),
+                                  MIN_COMPARE_BLOCK, READ_BLOCK);
+  std::vector<Member> members (bucket.files.size ());
+  for (usize i = 0; i < members.size (); ++i)
+    members[i] = {bucket.files[i],
+                  (i < MAX_OPEN_FILES
+                   ? ::open (bucket.files[i]->path.c_str (),
+                             O_RDONLY | O_NOFOLLOW)
+                   : -1),
+                  {}};
+  // Files that were equal so far, in groups of at least two
+  std::vector<std::vector<Member *>> groups (1);
+  for (Member &m : members)
+    groups[0].push_back (&m);
+  for (u64 offset = 0; offset < bucket.size && !groups.empty ();
+       offset += block)
+    {
+      const usize len = std::min<u64> (block, bucket.size - offset);
+      std::vector<std::vector<Member *>> split;
+      for (const std::vector<Member *> &group : groups)
+        {
+          const usize first = split.size ();
+          for (Member *m : group)
+            {
+              if (!read_block (*m, offset, len))
+                continue;
+              // Collisions are rare, usually all files match the first
+              const auto same = std::find_if (
+                split.begin () + first, split.end (),
+                [&](const std::vector<Member *> &s) {
+                  return std::memcmp (s.front ()->data.data (),
+                                      m->data.data (), len) == 0;
+                });
+              if (same != split.end ())
+                same->push_back (m);
+              else
+                split.push_back ({m});
+            }
+        }
+      std::erase_if (split, [](const std::vector<Member *> &s) {
+        return s.size () < 2;
+      });
+      groups = std::move (split);
+    }
+  for (const Member &m : members)
+    if (m.fd != -1)
+      ::close (m.fd);
+
+  std::vector<Bucket> result;
+  for (const std::vector<Member *> &group : groups)
+    {
+      Bucket &b = result.emplace_back (bucket.size, std::vector<Candidate *> {});
+      for (const Member *m : group)
+        b.files.push_back (m->file);
+    }
+  return result;
+}
+
+// Splits the buckets of files with equal hashes into groups of files with
+// equal contents, dropping files without a copy.
+static std::vector<Bucket>
+confirm (const std::vector<Bucket> &buckets)
+{
+  std::vector<std::vector<Bucket>> split (buckets.size ());
+  parallel_for (buckets.size (), [&](usize i) {
+    split[i] = confirm_bucket (buckets[i]);
+  });
+  std::vector<Bucket> result;
+  for (std::vector<Bucket> &s : split)
+    std::move (s.begin (), s.end (), std::back_inserter (result));
+  return result;
+}
+
+static bool
+is_below (const fs::path &path, const fs::path &dir)
+{
+  const std::string &p = path.native ();
+  const std::string &d = dir.native ();
+  return (p.starts_with (d)
+          && (d.ends_with ('/') || p.size () == d.size () || p[d.size ()] == '/'));
+}
+
+std::vector<Group>
+find (const fs::path &under)
+{
+  // Copy the candidates so the scanner can keep recording files
+  std::deque<Candidate> candidates;
+  std::vector<Bucket> buckets;
+  {
+    std::lock_guard lock (S_mutex);
+    for (const auto &[size, files] : S_by_size)
+      {
+        if (files.size () < 2)
+          continue;
+        Bucket b {size, {}};
+        for (const Recorded &r : files)
+          if (is_below (r.path, under))
+            {
+              candidates.push_back (Candidate {r.path, {0, 0}});
+              b.files.push_back (&candidates.back ());
+            }
+        if (b.files.size () > 1)
+          buckets.push_back (std::move (b));
+      }
+  }
+
+  // The partial hash rules out most files cheaply, the rest are compared
+  // byte by byte
+  buckets = refine (buckets, partial_hash);
+  buckets = confirm (buckets);
+
+  std::vector<Group> groups;
+  for (const Bucket &b : buckets)
+    {
+      Group &g = groups.emplace_back (b.size, std::vector<fs::path> {});
+      for (const Candidate *c : b.files)
+        g.paths.push_back (c->path);
+      std::sort (g.paths.begin (), g.paths.end ());
+    }
+  std::sort (groups.begin (), groups.end (), [](const Group &a, const Group &b) {
+    return a.reclaimable () > b.reclaimable ();
+  });
+  return groups;
+}
+}
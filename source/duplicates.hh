@@ -0,0 +1,28 @@
+#pragma once
+#include "stdafx.hh"
+
+namespace Duplicates
+{
+struct Group
+{
+  u64 size;
+  std::vector<fs::path> paths;
+
+  u64 reclaimable () const { return size * (paths.size () - 1); }
+};
+
+// Remembers a regular file seen during the scan.  Files are identified by
+// their inode so hard links and files seen by repeated scans only get
+// recorded once.
+void record (const fs::path &path, const struct stat &sb);
+
+// Forgets the recorded files at or below `path', which was removed or is
+// about to be scanned again.  With `missing_only' the files that still exist
+// are kept.
+void forget (const fs::path &path, bool missing_only = false);
+
+// Finds groups of identical files below the given directory among the
+// recorded files, sorted by the number of bytes that could be reclaimed.
+// Files only end up in a group after comparing their contents byte by byte.
+std::vector<Group> find (const fs::path &under);
+}
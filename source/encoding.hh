@@ -0,0 +1,113 @@
+#pragma once
+#include "stdafx.hh"
+
+// Appends integers as LEB128 varints and length prefixed strings to a byte
+// buffer.
+class Encoder
+{
+public:
+  void
+  uint (u64 value)
+  {
+    while (value >= 0x80)
+      {
+        data_.push_back (static_cast<char> (value | 0x80));
+        value >>= 7;
+      }
+    data_.push_back (static_cast<char> (value));
+  }
+
+  void
+  sint (s64 value)
+  { uint ((static_cast<u64> (value) << 1) ^ static_cast<u64> (value >> 63)); }
+
+  void
+  string (std::string_view str)
+  {
+    uint (str.size ());
+    data_.append (str);
+  }
+
+  void
+  raw (std::string_view bytes)
+  { data_.append (bytes); }
+
+  const std::string & data () const { return data_; }
+  std::string & data () { return data_; }
+  usize size () const { return data_.size (); }
+  void clear () { data_.clear (); }
+
+private:
+  std::string data_;
+};
+
+// Reads values written by an `Encoder'.  Reading past the end or a malformed
+// varint makes all further reads return 0 and `ok' return false.
+class Decoder
+{
+public:
+  Decoder (std::string_view data)
+    : pos_ (data.data ()), end_ (data.data () + data.size ())
+  {}
+
+  u64
+  uint ()
+  {
+    u64 value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7)
+      {
+        if (pos_ == end_)
+          break;
+        const u8 byte = *pos_++;
+        value |= static_cast<u64> (byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+          return value;
+      }
+    pos_ = end_;
+    ok_ = false;
+    return 0;
+  }
+
+  // Reads an unsigned value that has to be at most `max', anything bigger is
+  // malformed.
+  u64
+  uint (u64 max)
+  {
+    const u64 value = uint ();
+    if (value <= max)
+      return value;
+    pos_ = end_;
+    ok_ = false;
+    return 0;
+  }
+
+  s64
+  sint ()
+  {
+    const u64 value = uint ();
+    return static_cast<s64> ((value >> 1) ^ (~(value & 1) + 1));
+  }
+
+  std::string_view
+  string ()
+  {
+    const u64 size = uint ();
+    if (size > static_cast<u64> (end_ - pos_))
+      {
+        pos_ = end_;
+        ok_ = false;
+        return {};
+      }
+    const std::string_view str (pos_, size);
+    pos_ += size;
+    return str;
+  }
+
+  bool ok () const { return ok_; }
+  bool at_end () const { return pos_ == end_; }
+
+private:
+  const char *pos_;
+  const char *end_;
+  bool ok_ = true;
+};
@@ -0,0 +1,133 @@
+#include "estimate.hh"
+#include "throttle.hh"
+
+Estimator::Estimator (const fs::path &root)
+  : root_ (root), rng_ (std::random_device {} ())
+{
+}
+
+// Lists the directory at `path_' into `listing'.
+void
+Estimator::list (Listing &listing)
+{
+  listing.listed = true;
+  if (&listing != &tree_)
+    --uncached_;
+  std::error_code error;
+  struct stat sb;
+  for (const fs::directory_entry &entry : fs::directory_iterator (path_, error))
+    {
+      Throttle::acquire ();
+      const Throttle::Clock::time_point start = Throttle::Clock::now ();
+      const int result = ::lstat (entry.path ().c_str (), &sb);
+      Throttle::record (Throttle::Clock::now () - start);
+      if (result == -1)
+        continue;
+      if (S_ISDIR (sb.st_mode))
+        listing.subdirs.push_back (entry.path ().filename ().native ());
+      else if (S_ISREG (sb.st_mode) || S_ISLNK (sb.st_mode))
+        {
+          listing.size += sb.st_size;
+          ++listing.file_count;
+        }
+    }
+  if (error)
+    listing.error = error.value ();
+  listing.children.resize (listing.subdirs.size ());
+  uncached_ += listing.subdirs.size ();
+}
+
+void
+Estimator::walk ()
+{
+  path_ = root_.native ();
+  Listing *listing = &tree_;
+  f64 weight = 1.0;
+  f64 size = 0.0;
+  f64 count = 0.0;
+  for (;;)
+    {
+      if (!listing->listed)
+        list (*listing);
+      size += weight * listing->size;
+      count += weight * listing->file_count;
+      if (listing->subdirs.empty ())
+        break;
+      std::uniform_int_distribution<usize> pick (0, listing->subdirs.size () - 1);
+      const usize i = pick (rng_);
+      weight *= listing->subdirs.size ();
+      (path_ += '/') += listing->subdirs[i];
+      std::unique_ptr<Listing> &child = listing->children[i];
+      if (!child)
+        child = std::make_unique<Listing> ();
+      listing = child.get ();
+    }
+  ++walks_;
+  size_sum_ += size;
+  size_sq_sum_ += size * size;
+  count_sum_ += count;
+}
+
+bool
+Estimator::exact_totals (const Listing &listing, u64 &size, u64 &count)
+{
+  if (!listing.listed)
+    return false;
+  size += listing.size;
+  count += listing.file_count;
+  for (const std::unique_ptr<Listing> &child : listing.children)
+    if (!child || !exact_totals (*child, size, count))
+      return false;
+  return true;
+}
+
+bool
+Estimator::run (std::chrono::steady_clock::time_point until,
+                const std::atomic<bool> &stop)
+{
+  // An unreadable root would look like an empty tree
+  if (!tree_.listed)
+    {
+      path_ = root_.native ();
+      list (tree_);
+    }
+  if (tree_.error)
+    {
+      errno = tree_.error;
+      return false;
+    }
+  if (exact_)
+    return true;
+  // More walks only go over cached listings once the whole tree is cached
+  do
+    walk ();
+  while (uncached_ && !stop && std::chrono::steady_clock::now () < until);
+  if (!uncached_)
+    {
+      u64 size = 0, count = 0;
+      exact_ = exact_totals (tree_, size, count);
+      exact_size_ = size;
+      exact_count_ = count;
+    }
+  return true;
+}
+
+Estimator::Estimate
+Estimator::estimate () const
+{
+  if (exact_)
+    return {exact_size_, exact_count_, 0, walks_, true};
+  const f64 n = walks_;
+  const f64 mean = size_sum_ / n;
+  // Without a second walk there is no variance, claim the full size as the
+  // error.
+  f64 margin = mean;
+  if (walks_ > 1)
+    {
+      const f64 variance = std::max (0.0, (size_sq_sum_ - n * mean * mean)
+                                          / (n - 1));
+      margin = 1.96 * std::sqrt (variance / n);
+    }
+  return {static_cast<u64> (mean), static_cast<u64> (count_sum_ / n),
+          static_cast<u64> (margin), walks_, false};
+}
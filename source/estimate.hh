@@ -0,0 +1,75 @@
+#pragma once
+#include "stdafx.hh"
+#include <random>
+
+// Estimates the size and file count of a subtree from random walks down the
+// tree (Knuth's estimator).  Each walk starts at the root and descends into
+// a random subdirectory at every level; the sizes of the files seen on the
+// way, scaled by the product of the branching factors, are an unbiased
+// estimate of the subtree total.  Averaging more walks refines the estimate
+// and their variance gives a confidence interval.
+class Estimator
+{
+public:
+  struct Estimate
+  {
+    u64 size;
+    u64 file_count;
+    // Half width of the 95% confidence interval of the size
+    u64 margin;
+    u64 walks;
+    // Set if every directory of the subtree was seen, the values are exact
+    bool exact;
+  };
+
+public:
+  explicit Estimator (const fs::path &root);
+
+  // Does random walks until the given point in time or until `stop' is set.
+  // Returns false and sets errno if the root cannot be read.
+  bool
+  run (std::chrono::steady_clock::time_point until,
+       const std::atomic<bool> &stop);
+
+  Estimate estimate () const;
+
+private:
+  // The listings seen so far form a tree, walks follow it down without
+  // looking up paths.
+  struct Listing
+  {
+    bool listed = false;
+    u64 size = 0;
+    u64 file_count = 0;
+    std::vector<std::string> subdirs;
+    // Listings of the subdirectories, null until a walk gets there
+    std::vector<std::unique_ptr<Listing>> children;
+    // errno if the directory could not be read
+    int error = 0;
+  };
+
+  void list (Listing &listing);
+
+  void walk ();
+
+  // Returns the exact totals of the subtree if all of its directories have
+  // been listed.
+  static bool exact_totals (const Listing &listing, u64 &size, u64 &count);
+
+private:
+  fs::path root_;
+  Listing tree_;
+  // Directories seen in a listing that have not been listed themselves, the
+  // tree is complete once this is 0
+  u64 uncached_ = 0;
+  // Path of the directory the walk is in, kept to reuse its buffer
+  std::string path_;
+  std::mt19937_64 rng_;
+  u64 walks_ = 0;
+  f64 size_sum_ = 0.0;
+  f64 size_sq_sum_ = 0.0;
+  f64 count_sum_ = 0.0;
+  bool exact_ = false;
+  u64 exact_size_ = 0;
+  u64 exact_count_ = 0;
+};
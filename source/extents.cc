@@ -0,0 +1,84 @@
+#include "extents.hh"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+
+// Number of extents fetched per ioctl
+static constexpr u32 BATCH = 64;
+
+bool
+ExtentMap::first_use (dev_t dev, u64 physical)
+{
+  std::lock_guard lock (mutex_);
+  return shared_.emplace (dev, physical).second;
+}
+
+bool
+ExtentMap::add_file (int dir_fd, const char *name, const struct stat &sb,
+                     ExtentUsage &usage)
+{
+  {
+    std::lock_guard lock (mutex_);
+    if (unsupported_.contains (sb.st_dev))
+      return false;
+  }
+  const int fd = ::openat (dir_fd, name,
+                           O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+  if (fd == -1)
+    return false;
+  alignas (struct fiemap) std::array<std::byte, (sizeof (struct fiemap)
+                                                 + (BATCH
+                                                    * sizeof (fiemap_extent)))>
+    buffer {};
+  struct fiemap *const map = reinterpret_cast<struct fiemap *> (buffer.data ());
+  ExtentUsage found;
+  found.files = 1;
+  bool ok = true;
+  bool last = false;
+  map->fm_start = 0;
+  while (!last)
+    {
+      map->fm_length = FIEMAP_MAX_OFFSET - map->fm_start;
+      map->fm_flags = 0;
+      map->fm_extent_count = BATCH;
+      if (::ioctl (fd, FS_IOC_FIEMAP, map) == -1)
+        {
+          if (errno == EOPNOTSUPP || errno == ENOTTY)
+            {
+              std::lock_guard lock (mutex_);
+              unsupported_.insert (sb.st_dev);
+            }
+          ok = false;
+          break;
+        }
+      if (map->fm_mapped_extents == 0)
+        break;
+      for (u32 i = 0; i < map->fm_mapped_extents; ++i)
+        {
+          const fiemap_extent &e = map->fm_extents[i];
+          // Extents without a known location, like those not written out
+          // yet, cannot be shared.
+          if (!(e.fe_flags & FIEMAP_EXTENT_SHARED)
+              || (e.fe_flags & FIEMAP_EXTENT_UNKNOWN))
+            {
+              found.exclusive += e.fe_length;
+              found.allocated += e.fe_length;
+            }
+          else
+            {
+              found.shared += e.fe_length;
+              if (first_use (sb.st_dev, e.fe_physical))
+                found.allocated += e.fe_length;
+            }
+          last = e.fe_flags & FIEMAP_EXTENT_LAST;
+        }
+      const fiemap_extent &e = map->fm_extents[map->fm_mapped_extents - 1];
+      map->fm_start = e.fe_logical + e.fe_length;
+    }
+  ::close (fd);
+  if (ok)
+    usage.merge (found);
+  return ok;
+}
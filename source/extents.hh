@@ -0,0 +1,43 @@
+#pragma once
+#include "stdafx.hh"
+#include "summary.hh"
+#include "walk.hh"
+
+// Extent aware sizes from the FIEMAP ioctl.  With reflinks or deduplication
+// the size of a file says little about what deleting it frees, the extents
+// flagged as shared are used by other files as well and stay allocated.
+// Checking a file costs an open and an ioctl, so only files of at least a
+// minimum size get checked.  Shared by all walks of one scan, which may run
+// on different threads.
+class ExtentMap
+{
+public:
+  explicit ExtentMap (u64 min_size) : min_size_ (min_size) {}
+
+  // Returns whether the extents of the file get checked.
+  bool
+  checks (const struct stat &sb) const
+  {
+    return S_ISREG (sb.st_mode) && static_cast<u64> (sb.st_size) >= min_size_;
+  }
+
+  // Adds the extents of the file `name' relative to `dir_fd' to `usage'.  A
+  // shared extent counts as shared for every file using it, but only towards
+  // the allocated bytes the first time a walk of the scan finds it.
+  // Returns false if the extents cannot be read, like on file systems without
+  // FIEMAP, and then leaves `usage' alone.
+  bool add_file (int dir_fd, const char *name, const struct stat &sb,
+                 ExtentUsage &usage);
+
+private:
+  // Returns whether the shared extent at `physical' is found for the first
+  // time.
+  bool first_use (dev_t dev, u64 physical);
+
+  u64 min_size_;
+  std::mutex mutex_;
+  // Shared extents by device and physical offset
+  std::unordered_set<std::pair<dev_t, u64>, DeviceIdHash> shared_;
+  // Devices without FIEMAP support, their files are not opened again
+  std::unordered_set<dev_t> unsupported_;
+};
@@ -60,10 +60,13 @@ read_special_from_escape ()
 }
 
 int
-get_char ()
+get_char (int timeout_ms)
 {
   int ch;
-  switch (ch = getch ())
+  timeout (timeout_ms);
+  ch = getch ();
+  timeout (-1);
+  switch (ch)
     {
       case 0: return Special::CtrlSpace;
       case 1: return Special::CtrlA;
@@ -74,6 +77,18 @@ get_char ()
     }
 }
 
+bool
+pending ()
+{
+  nodelay (stdscr, true);
+  const int ch = getch ();
+  nodelay (stdscr, false);
+  if (ch == ERR)
+    return false;
+  ungetch (ch);
+  return true;
+}
+
 std::string_view
 get_line (History *history, GetLineCallback callback)
 {
@@ -1,5 +1,6 @@
 #pragma once
 #include "stdafx.hh"
+#include <ncurses.h>
 #include "options.hh"
 
 namespace Input
@@ -78,7 +79,12 @@ private:
 
 using GetLineCallback = std::function<void (History::const_reference)>;
 
-int get_char ();
+// Waits for a key for at most `timeout_ms' milliseconds, or indefinitely if
+// it is negative.  Returns ERR if no key was pressed in time.
+int get_char (int timeout_ms = -1);
+
+// Returns whether a key is waiting to be read.
+bool pending ();
 
 std::string_view get_line (History *history = nullptr,
                            GetLineCallback callback = nullptr);
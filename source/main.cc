@@ -4,15 +4,73 @@
 #include "display.hh"
 #include "select.hh"
 #include "input.hh"
+#include "duplicates.hh"
+#include "remove.hh"
+#include "remote.hh"
+#include "scheduler.hh"
+#include "throttle.hh"
+#include "alloc_stats.hh"
+#include "mounts.hh"
+#include "watch.hh"
+#include "archive.hh"
+#include "scan.hh"
+#include "snapshot.hh"
 #include "nc-help/help.h"
+#include <pwd.h>
+#include <grp.h>
+#include <sys/statvfs.h>
 
-static void
+// Shows the listing so far, returns false if the user cancelled the scan.
+static bool
 show_progress (const SpaceInfo &si)
 {
   Display::set_space_info (&si);
   Display::space_info (false);
   Display::footer ();
   Display::refresh ();
+  const int ch = Input::get_char (0);
+  if (ch == Input::Special::Escape || ch == 'q')
+    {
+      Scheduler::cancel ();
+      return false;
+    }
+  // Keep other keys for the main loop
+  if (ch != ERR && ch < Input::Special::Unused)
+    ungetch (ch);
+  return true;
+}
+
+// Gets the listing of a directory, from the daemon if connected to one.
+// Archives and directories inside them are listed from the archive.
+static SpaceInfo *
+load_dir (const fs::path &path, bool reload = false)
+{
+  if (Options::view_snapshot)
+    {
+      if (reload)
+        G_dirs.erase (path);
+      return Snapshot::load (Options::view_snapshot, path);
+    }
+  if (Options::connect_socket)
+    return Remote::fetch (Options::connect_socket, path, reload);
+  if (reload)
+    G_dirs.erase (path);
+  if (Archive::contains (path))
+    {
+      if (reload)
+        Archive::invalidate ();
+      return Archive::load (path);
+    }
+  return process_dir (path, show_progress);
+}
+
+// Returns whether `path' can be listed by `load_dir'.
+static bool
+can_enter (const fs::path &path)
+{
+  if (Options::view_snapshot)
+    return Snapshot::contains (Options::view_snapshot, path);
+  return fs::is_directory (path) || Archive::contains (path);
 }
 
 void
@@ -20,9 +78,61 @@ fail ()
 {
   std::fputs (G_error.message ().c_str (), stderr);
   std::fputc ('\n', stderr);
+  Remove::shutdown ();
   std::exit (1);
 }
 
+// Scans the directory and everything below it and prints how long it took
+// and how many allocations were made.
+static int
+bench (const fs::path &path)
+{
+  using Clock = std::chrono::steady_clock;
+  AllocStats::start ();
+  const Clock::time_point start = Clock::now ();
+  const SpaceInfo *const si = process_dir (path);
+  if (si == nullptr)
+    fail ();
+  finish_scans ();
+  const f64 seconds = std::chrono::duration<f64> (Clock::now () - start).count ();
+  const u64 files = si->total_file_count ();
+  const u64 count = AllocStats::count ();
+  std::printf ("%s: %" PRIu64 " files, %" PRIu64 " bytes in %.3f s"
+               " (%.0f files/s)\n",
+               path.c_str (), files, si->total (), seconds, files / seconds);
+  std::printf ("allocations: %" PRIu64 " (%.2f per file), %" PRIu64
+               " bytes\n",
+               count, files ? static_cast<f64> (count) / files : 0.0,
+               AllocStats::bytes ());
+  return 0;
+}
+
+// Scans the directory and everything below it into a snapshot file.
+static int
+write_snapshot (const fs::path &path)
+{
+  Scan::Config config;
+  config.tree_depth = 0;
+  config.max_depth = Options::max_depth;
+  config.keep_files = true;
+  config.follow_symlinks = Options::follow_symlinks;
+  Scan::Handle scan (path, config);
+  if (scan.run () == ScanStatus::Failed)
+    {
+      G_error = scan.error ();
+      fail ();
+    }
+  if (!Snapshot::write (Options::snapshot_file, scan,
+                        (Options::snapshot_base ? Options::snapshot_base
+                         : fs::path {})))
+    {
+      std::fprintf (stderr, "%s: %s\n", Options::snapshot_file,
+                    G_error.message ().c_str ());
+      return 1;
+    }
+  return 0;
+}
+
 static bool
 help ()
 {
@@ -33,14 +143,25 @@ help ()
     {"J/PgDn",      "Move cursor down multiple items"},
     {"g/Home",      "Move cursor to the start"},
     {"G/End",       "Move cursor to the bottom"},
-    {"Enter/Space", "Enter the directory under the cursor"},
+    {"Enter/Space", "Enter the directory or archive under the cursor"},
     {"r/i",         "Reverse sorting order"},
+    {"s",           "Cycle sort key (size, name, file count, modified)"},
     {"'/'",         "Begin search"},
     {"n",           "Select the next search result"},
     {"N",           "Select the previous search result"},
     {"c",           "Clear search"},
     {"h",           "Go to a specific path"},
-    {"R",           "Reload the current directory"}
+    {"R",           "Reload the current directory"},
+    {"u",           "Rescan only the entry under the cursor"},
+    {"e",           "Show file types of the entry under the cursor"},
+    {"a",           "Cycle cold data view (30, 90, 365 days, off)"},
+    {"A",           "Show age distribution of the entry under the cursor"},
+    {"z",           "Show file size distribution of the entry under the cursor"},
+    {"D",           "Find duplicate files (needs -dupes)"},
+    {"M",           "Show mounted file systems"},
+    {"d",           "Delete the entry under the cursor"},
+    {"o",           "Show owners of the entry under the cursor"},
+    {"Esc",         "Stop scanning, keeping partial sizes"}
   };
   static nc_help::Help help (help_text);
 
@@ -123,33 +244,354 @@ get_go_to_path ()
   });
 }
 
+static void
+show_file_types (const SpaceInfo &si, const fs::path &path)
+{
+  const usize idx = Display::cursor ();
+  const Summary summary = si.summary_of (idx);
+  std::vector<Display::ReportRow> rows;
+  for (const auto &e : summary.extensions)
+    rows.emplace_back (Extension::name (e.key), e.bytes, e.count);
+  std::sort (rows.begin (), rows.end (),
+             [](const Display::ReportRow &a, const Display::ReportRow &b) {
+               return a.size > b.size;
+             });
+  const fs::path of = idx == 0 ? path : path / si[idx].path;
+  Display::report ("File types in " + of.native (), rows);
+}
+
+static void
+show_ages (const SpaceInfo &si, const fs::path &path)
+{
+  const usize idx = Display::cursor ();
+  const Summary summary = si.summary_of (idx);
+  std::vector<Display::ReportRow> rows;
+  auto add_rows = [&rows](const char *what, const AgeHistogram &hist) {
+    for (usize i = 0; i < Age::BUCKETS; ++i)
+      if (hist.count[i])
+        rows.emplace_back (what + Age::bucket_name (i), hist.bytes[i],
+                           hist.count[i]);
+  };
+  add_rows ("Not used for ", summary.idle);
+  add_rows ("Not modified for ", summary.modified);
+  add_rows ("Not accessed for ", summary.accessed);
+  const fs::path of = idx == 0 ? path : path / si[idx].path;
+  Display::report ("File ages in " + of.native (), rows);
+}
+
+static void
+show_sizes (const SpaceInfo &si, const fs::path &path)
+{
+  const usize idx = Display::cursor ();
+  const Summary summary = si.summary_of (idx);
+  const fs::path of = idx == 0 ? path : path / si[idx].path;
+  // Archives and snapshots are not on a file system, assume a common one
+  u64 block_size = 4096;
+  u64 inodes = 0;
+  struct statvfs vfs;
+  if (::statvfs (path.c_str (), &vfs) == 0)
+    {
+      block_size = vfs.f_frsize ? vfs.f_frsize : vfs.f_bsize;
+      inodes = vfs.f_files;
+    }
+  u64 files = 0;
+  for (const auto &e : summary.sizes)
+    files += e.count;
+  std::vector<Display::ReportRow> rows;
+  // Files smaller than a block still take a whole one and an inode, empty
+  // files only take the inode
+  u64 small_count = 0;
+  u64 small_blocks = 0;
+  u64 small_bytes = 0;
+  for (const auto &e : summary.sizes)
+    {
+      rows.emplace_back (FileSize::bucket_name (e.key), e.bytes, e.count,
+                         f64 (e.count) / files);
+      if (FileSize::bucket_min (e.key + 1u) <= block_size)
+        {
+          small_count += e.count;
+          if (e.key)
+            small_blocks += e.count;
+          small_bytes += e.bytes;
+        }
+    }
+  std::string title = "File sizes in " + of.native ();
+  if (small_blocks)
+    {
+      const u64 allocated = small_blocks * block_size;
+      rows.emplace_back ("Unused space in the blocks of files under "
+                           + std::to_string (block_size) + " bytes",
+                         allocated - small_bytes, small_blocks,
+                         f64 (allocated - small_bytes) / allocated);
+    }
+  if (small_count && inodes)
+    {
+      char share[64];
+      std::snprintf (share, sizeof share,
+                     ", %.2f%% of the inodes used by small files",
+                     100.0 * small_count / inodes);
+      title += share;
+    }
+  if (const ExtentUsage &extents = summary.extents; extents.files)
+    {
+      const u64 checked = extents.exclusive + extents.shared;
+      rows.emplace_back ("Exclusive extents of the files checked for them",
+                         extents.exclusive, extents.files,
+                         checked ? f64 (extents.exclusive) / checked : 0.0);
+      rows.emplace_back ("Shared extents of the files checked for them",
+                         extents.shared, extents.files,
+                         checked ? f64 (extents.shared) / checked : 0.0);
+      rows.emplace_back ("Allocated for them, shared extents counted once",
+                         extents.allocated, extents.files,
+                         checked ? f64 (extents.allocated) / checked : 0.0);
+    }
+  Display::report (title, rows);
+}
+
+static const std::string &
+owner_name (bool group, u32 id)
+{
+  static std::map<std::pair<bool, u32>, std::string> S_names;
+  const auto [it, inserted] = S_names.try_emplace ({group, id});
+  if (inserted)
+    {
+      const char *name = nullptr;
+      if (group)
+        {
+          if (const struct group *gr = ::getgrgid (id))
+            name = gr->gr_name;
+        }
+      else if (const struct passwd *pw = ::getpwuid (id))
+        name = pw->pw_name;
+      it->second = name ? name : std::to_string (id);
+    }
+  return it->second;
+}
+
+static void
+show_owners (const SpaceInfo &si, const fs::path &path)
+{
+  const usize idx = Display::cursor ();
+  const Summary summary = si.summary_of (idx);
+  std::vector<Display::ReportRow> rows;
+  auto add_rows = [&rows](bool group, const auto &tally) {
+    const usize first = rows.size ();
+    for (const auto &e : tally)
+      rows.emplace_back ((group ? "group " : "user ") + owner_name (group, e.key),
+                         e.bytes, e.count);
+    std::sort (rows.begin () + first, rows.end (),
+               [](const Display::ReportRow &a, const Display::ReportRow &b) {
+                 return a.size > b.size;
+               });
+  };
+  add_rows (false, summary.users);
+  add_rows (true, summary.groups);
+  const fs::path of = idx == 0 ? path : path / si[idx].path;
+  Display::report ("Owners of " + of.native (), rows);
+}
+
+static void
+show_duplicates (const fs::path &path)
+{
+  if (!Options::find_duplicates)
+    {
+      Display::format_footer ("Duplicate detection needs the -dupes option");
+      return;
+    }
+  // Files are still being recorded, the groups would be incomplete
+  if (Scheduler::busy ())
+    {
+      Display::format_footer ("Duplicates can be searched once the scan is "
+                              "done");
+      return;
+    }
+  Display::format_footer ("Searching for duplicates...");
+  Display::refresh ();
+  const std::vector<Duplicates::Group> groups = Duplicates::find (path);
+  std::vector<Display::ReportRow> rows;
+  u64 total = 0;
+  for (const Duplicates::Group &g : groups)
+    {
+      total += g.reclaimable ();
+      rows.emplace_back (fs::relative (g.paths.front (), path).native (),
+                         g.reclaimable (), g.paths.size ());
+    }
+  char title[64];
+  std::snprintf (title, sizeof (title),
+                 "%zu duplicate groups, %" PRIu64 " bytes reclaimable",
+                 groups.size (), total);
+  ssize group;
+  while ((group = Display::report (title, rows)) != -1)
+    {
+      std::vector<Display::ReportRow> files;
+      for (const fs::path &p : groups[group].paths)
+        files.emplace_back (p.native (), groups[group].size, 1);
+      Display::report ("Copies of " + rows[group].label, files);
+    }
+  Display::clear ();
+  Display::header ();
+  Display::footer ();
+}
+
+// Shows the usage of all mounted file systems.  Returns the mount point that
+// was selected or an empty path.
+static fs::path
+show_mounts ()
+{
+  const std::vector<Mounts::Mount> mounts = Mounts::list ();
+  std::vector<Display::ReportRow> rows;
+  for (const Mounts::Mount &m : mounts)
+    {
+      char label[PATH_MAX + 128];
+      if (m.error)
+        std::snprintf (label, sizeof (label), "%s (%s)",
+                       m.mount_point.c_str (), std::strerror (m.error));
+      else
+        std::snprintf (label, sizeof (label),
+                       "%s (%s on %s, %.0f%% full, %.0f%% of inodes)",
+                       m.mount_point.c_str (), m.type.c_str (),
+                       m.source.c_str (), 100.0 * m.used () / m.size,
+                       m.inodes ? 100.0 * m.used_inodes () / m.inodes : 0.0);
+      rows.emplace_back (label, m.used (), m.used_inodes (),
+                         m.size ? static_cast<f64> (m.used ()) / m.size : 0.0);
+    }
+  const ssize selected = Display::report ("Mounted file systems", rows);
+  return selected == -1 ? fs::path {} : mounts[selected].mount_point;
+}
+
+static void
+confirm_remove (const SpaceInfo &si, const fs::path &path)
+{
+  const usize idx = Display::cursor ();
+  if (idx == 0 || si[idx].error || Options::view_snapshot
+      || Archive::contains (path))
+    return;
+  const fs::path target = path / si[idx].path;
+  if (Remove::in_progress (target))
+    return;
+  Display::format_footer ("Delete %s%s? [y/N]", target.c_str (),
+                          si[idx].is_directory ? "/" : "");
+  Display::refresh ();
+  if (Input::get_char () == 'y')
+    Remove::start (target);
+  Display::footer ();
+}
+
+// Applies finished removals to the cached directories and redraws if there
+// were any.  The cursor stays on the same item unless that was removed.
+static void
+finish_removals (const SpaceInfo &si)
+{
+  std::vector<Remove::Result> results = Remove::finished ();
+  if (results.empty ())
+    return;
+  const usize cursor = Display::cursor ();
+  const fs::path at_cursor = cursor ? si[cursor].path : fs::path ();
+  for (const Remove::Result &r : results)
+    apply_removal (r.path, r.size, r.file_count, !r.error);
+  if (const usize idx = cursor ? si.index_of (at_cursor) : 0)
+    Display::set_cursor (idx);
+  else
+    Display::move_cursor (0);
+  Display::clear ();
+  Display::header ();
+  Display::footer ();
+  for (const Remove::Result &r : results)
+    if (r.error)
+      Display::format_footer ("Could not delete %s: %s", r.path.c_str (),
+                              r.error.message ().c_str ());
+}
+
+// Moves sizing the directory under the cursor and the ones the cursor is
+// moving towards to the front of the scan queue.
+static void
+prioritize_cursor (const SpaceInfo &si, const fs::path &path, int direction)
+{
+  // Number of items ahead of the cursor to prioritize
+  constexpr ssize LOOKAHEAD = 4;
+  const ssize cursor = Display::cursor ();
+  for (ssize i = direction ? LOOKAHEAD : 0; i >= 0; --i)
+    {
+      const ssize idx = cursor + i * direction;
+      if (idx > 0 && idx <= static_cast<ssize> (si.item_count ())
+          && si[idx].partial)
+        Scheduler::prioritize (path, si[idx].path);
+    }
+}
+
+// Applies finished scans while keeping the cursor on the same item.
+// Returns whether anything changed.
+static bool
+apply_scans (const SpaceInfo &si)
+{
+  const usize cursor = Display::cursor ();
+  const fs::path at_cursor = cursor ? si[cursor].path : fs::path ();
+  if (!apply_scan_results ())
+    return false;
+  if (cursor)
+    Display::set_cursor (si.index_of (at_cursor));
+  return true;
+}
+
+static u32
+next_cold_days (u32 days)
+{
+  switch (days)
+    {
+      case 0: return 30;
+      case 30: return 90;
+      case 90: return 365;
+      default: return 0;
+    }
+}
+
+static SortKey
+next_sort_key (SortKey key)
+{
+  const u8 next = static_cast<u8> (key) + 1;
+  return (next == static_cast<u8> (SortKey::COUNT)
+          ? SortKey::Size : static_cast<SortKey> (next));
+}
+
 int
 main (const int argc, const char **argv)
 {
   const fs::path dev_path = "/dev";
   SpaceInfo *si;
   const char *const arg = parse_args (argc, argv);
-  fs::path path = (arg
-                   ? fs::canonical (fs::path (arg))
-                   : fs::current_path ());
+  fs::path path;
+  // The directories of a snapshot may not exist on this machine
+  if (Options::view_snapshot)
+    {
+      path = arg ? fs::path (arg) : Snapshot::root (Options::view_snapshot);
+      if (path.empty ())
+        fail ();
+    }
+  else
+    path = arg ? fs::canonical (fs::path (arg)) : fs::current_path ();
   fs::path pending_path;
-  bool sort_ascending = false;
+  SortKey sort_key = SortKey::Size;
+  bool sort_reversed = false;
+  u32 cold_days = 0;
 
   auto maybe_goto_pending = [&]() {
-    if (fs::is_directory (pending_path) && pending_path != dev_path)
+    if (can_enter (pending_path) && pending_path != dev_path)
       {
         path.swap (pending_path);
         Display::clear ();
         Display::set_path (path);
         Display::header ();
-        si = process_dir (path, show_progress);
+        SpaceInfo *const previous = si;
+        si = load_dir (path);
+        const std::error_code error = si ? std::error_code {} : G_error;
         if (si == nullptr)
           {
+            // A failed load leaves the cached listings alone, the current
+            // one stays as it is
             path.swap (pending_path);
             Display::set_path (path);
             Display::header ();
-            si = process_dir (path);
-            Display::set_space_info (si);
+            si = previous;
           }
         else
           {
@@ -158,7 +600,12 @@ main (const int argc, const char **argv)
           }
         Display::set_space_info (si);
         Display::footer ();
-        si->sort (sort_ascending = false);
+        if (error)
+          Display::format_footer ("Could not open %s: %s",
+                                  pending_path.c_str (),
+                                  error.message ().c_str ());
+        si->sort (sort_key, sort_reversed = false, cold_days);
+        Scheduler::prioritize (path);
       }
   };
 
@@ -171,51 +618,88 @@ main (const int argc, const char **argv)
       return 1;
     }
 
+  Throttle::configure (Options::max_rate, Options::adaptive_rate);
+  // Done before any scanning thread is started so they all inherit it
+  if (Options::idle_io && !Throttle::set_idle_priority ())
+    std::fprintf (stderr, "Could not set the I/O priority: %s\n",
+                  std::strerror (errno));
+
+  if (Options::bench)
+    return bench (path);
+
+  if (Options::snapshot_file)
+    return write_snapshot (path);
+
+  if (Options::watch_interval)
+    return Watch::run (path, Options::watch_interval, Options::metrics_file);
+
+  if (Options::daemon_socket)
+    return Remote::serve (Options::daemon_socket, path);
+
   Select::clear_selection ();
 
   Display::begin ();
+  // Picking a mount first avoids starting a walk of the given path
+  if (Options::show_mounts)
+    if (fs::path mount_point = show_mounts ();
+        !mount_point.empty () && mount_point != dev_path)
+      path = std::move (mount_point);
+  Display::clear ();
   Display::set_path (path);
   Display::header ();
-  si = process_dir (path, show_progress);
+  si = load_dir (path);
   if (si == nullptr)
     {
       Display::end ();
       fail ();
     }
+  Display::set_space_info (si);
   Display::space_info ();
   Display::footer ();
   Display::refresh ();
 
   int ch;
+  int direction;
   bool stop = false;
   while (!stop)
     {
-      ch = Input::get_char ();
+      // Wake up regularly to show the progress of background work
+      ch = Input::get_char (Remove::busy () || Scheduler::busy ()
+                            ? (Options::low_bandwidth ? 1000 : 250) : -1);
+      if (ch == ERR)
+        finish_removals (*si);
+      direction = 0;
       switch (ch)
         {
           case KEY_UP:
           case 'k':
             Display::move_cursor (-1);
+            direction = -1;
             break;
           case KEY_DOWN:
           case 'j':
             Display::move_cursor (1);
+            direction = 1;
             break;
           case KEY_HOME:
           case 'g':
             Display::set_cursor (0);
+            direction = 1;
             break;
           case KEY_END:
           case 'G':
             Display::set_cursor (si->item_count ());
+            direction = -1;
             break;
           case KEY_PPAGE:
           case 'K':
             Display::move_cursor (-Display::page_move_amount ());
+            direction = -1;
             break;
           case KEY_NPAGE:
           case 'J':
             Display::move_cursor (Display::page_move_amount ());
+            direction = 1;
             break;
           case 10: // Enter
           case ' ':
@@ -224,8 +708,13 @@ main (const int argc, const char **argv)
             break;
           case 'r':
           case 'i':
-            sort_ascending = !sort_ascending;
-            si->sort (sort_ascending);
+            sort_reversed = !sort_reversed;
+            si->sort (sort_key, sort_reversed, cold_days);
+            break;
+          case 's':
+            sort_key = next_sort_key (sort_key);
+            si->sort (sort_key, sort_reversed = false, cold_days);
+            Display::footer ();
             break;
           case '/':
             search (*si);
@@ -254,13 +743,92 @@ main (const int argc, const char **argv)
               Display::footer ();
             break;
           case 'R':
-            G_dirs.erase (path);
             Display::clear ();
             Display::header ();
-            si = process_dir (path, show_progress);
+            si = load_dir (path, true);
+            if (si == nullptr)
+              {
+                Display::end ();
+                fail ();
+              }
+            Display::set_space_info (si);
+            si->sort (sort_key, sort_reversed = false, cold_days);
             Display::space_info ();
             Display::footer ();
-            sort_ascending = false;
+            break;
+          case 'a':
+            cold_days = next_cold_days (cold_days);
+            Display::set_cold_days (cold_days);
+            si->sort (sort_key, sort_reversed, cold_days);
+            Display::footer ();
+            break;
+          case 'A':
+            show_ages (*si, path);
+            Display::clear ();
+            Display::header ();
+            Display::footer ();
+            break;
+          case 'z':
+            show_sizes (*si, path);
+            Display::clear ();
+            Display::header ();
+            Display::footer ();
+            break;
+          case 'e':
+            show_file_types (*si, path);
+            Display::clear ();
+            Display::header ();
+            Display::footer ();
+            break;
+          case 'D':
+            show_duplicates (path);
+            break;
+          case 'u':
+            if (const usize cursor = Display::cursor ();
+                cursor && !Options::view_snapshot
+                && !Archive::contains (path))
+              {
+                const fs::path name = (*si)[cursor].path;
+                if (Options::connect_socket)
+                  {
+                    // The daemon rescans a directory on a reload, files are
+                    // always listed with their current size
+                    if ((*si)[cursor].is_directory)
+                      Remote::fetch (Options::connect_socket, path / name,
+                                     true);
+                    G_dirs.erase (path);
+                    si = load_dir (path);
+                    if (si == nullptr)
+                      {
+                        Display::end ();
+                        fail ();
+                      }
+                    Display::set_space_info (si);
+                    si->sort (sort_key, sort_reversed, cold_days);
+                    Display::set_cursor (si->index_of (name));
+                  }
+                else if (refresh_entry (path, name))
+                  Display::set_cursor (si->index_of (name));
+                Display::footer ();
+              }
+            break;
+          case 'M':
+            pending_path = show_mounts ();
+            Display::clear ();
+            Display::header ();
+            if (pending_path.empty ())
+              Display::footer ();
+            else
+              maybe_goto_pending ();
+            break;
+          case 'd':
+            confirm_remove (*si, path);
+            break;
+          case 'o':
+            show_owners (*si, path);
+            Display::clear ();
+            Display::header ();
+            Display::footer ();
             break;
           case '?':
             if (help ())
@@ -269,8 +837,20 @@ main (const int argc, const char **argv)
             Display::header ();
             Display::footer ();
             break;
+          case Input::Special::Escape:
+            Scheduler::cancel ();
+            break;
           case 'q':
-            stop = true;
+            if (!Remove::busy ())
+              {
+                stop = true;
+                break;
+              }
+            Display::format_footer ("Deletions are still running, stop them"
+                                    " and quit? [y/N]");
+            Display::refresh ();
+            stop = Input::get_char () == 'y';
+            Display::footer ();
             break;
           case KEY_RESIZE:
 do_resize:
@@ -280,8 +860,16 @@ do_resize:
             Display::footer ();
             break;
         }
+      if (apply_scans (*si))
+        Display::footer ();
+      prioritize_cursor (*si, path, direction);
+      // Keys that are already waiting, like from holding one down, are all
+      // handled before drawing a single frame for them.
+      if (Options::low_bandwidth && Input::pending ())
+        continue;
       Display::space_info ();
       Display::refresh ();
     }
+  Remove::shutdown ();
   Display::end ();
 }
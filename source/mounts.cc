@@ -0,0 +1,176 @@
+#include "mounts.hh"
+#include <fstream>
+#include <sstream>
+#include <sys/statvfs.h>
+#include <sys/sysmacros.h>
+
+namespace Mounts
+{
+// How long a cached free space value is used
+static constexpr auto FREE_SPACE_TTL = std::chrono::seconds (5);
+
+struct CachedFree
+{
+  u64 free;
+  std::chrono::steady_clock::time_point time;
+};
+
+// Shared by the threads serving the daemon's clients
+static std::mutex S_free_mutex;
+static std::unordered_map<dev_t, CachedFree> S_free;
+
+// Undoes the octal escapes of spaces, tabs, newlines and backslashes in
+// mountinfo fields.
+static std::string
+unescape (std::string_view field)
+{
+  const auto is_octal = [](char c) { return c >= '0' && c <= '7'; };
+  std::string result;
+  result.reserve (field.size ());
+  for (usize i = 0; i < field.size (); ++i)
+    {
+      if (field[i] == '\\' && i + 3 < field.size ()
+          && is_octal (field[i + 1]) && is_octal (field[i + 2])
+          && is_octal (field[i + 3]))
+        {
+          result += static_cast<char> ((field[i + 1] - '0') * 64
+                                       + (field[i + 2] - '0') * 8
+                                       + (field[i + 3] - '0'));
+          i += 3;
+        }
+      else
+        result += field[i];
+    }
+  return result;
+}
+
+static void
+get_usage (Mount &mount)
+{
+  struct statvfs sv;
+  if (::statvfs (mount.mount_point.c_str (), &sv) == -1)
+    {
+      mount.error = errno;
+      return;
+    }
+  mount.size = static_cast<u64> (sv.f_blocks) * sv.f_frsize;
+  mount.free = static_cast<u64> (sv.f_bfree) * sv.f_frsize;
+  mount.available = static_cast<u64> (sv.f_bavail) * sv.f_frsize;
+  mount.inodes = sv.f_files;
+  mount.free_inodes = sv.f_ffree;
+}
+
+// Reads the visible mounts without their usage.
+static std::vector<Mount>
+read_mountinfo ()
+{
+  // Later mounts on the same mount point hide the earlier ones
+  std::map<fs::path, Mount> mounts;
+  std::ifstream mountinfo ("/proc/self/mountinfo");
+  std::string line;
+  while (std::getline (mountinfo, line))
+    {
+      // id parent major:minor root mount-point options [optional...] -
+      // type source super-options
+      std::istringstream fields (line);
+      std::string id, parent, device, root, mount_point, options, field;
+      fields >> id >> parent >> device >> root >> mount_point >> options;
+      while (fields >> field && field != "-")
+        ;
+      Mount mount {};
+      fields >> mount.type >> mount.source;
+      if (!fields)
+        continue;
+      unsigned major = 0, minor = 0;
+      std::sscanf (device.c_str (), "%u:%u", &major, &minor);
+      mount.dev = makedev (major, minor);
+      mount.mount_point = unescape (mount_point);
+      mount.source = unescape (mount.source);
+      mounts.insert_or_assign (mount.mount_point, std::move (mount));
+    }
+  std::vector<Mount> result;
+  result.reserve (mounts.size ());
+  for (auto &[mount_point, mount] : mounts)
+    result.push_back (std::move (mount));
+  return result;
+}
+
+std::vector<Mount>
+list ()
+{
+  std::vector<Mount> mounts = read_mountinfo ();
+  for (Mount &mount : mounts)
+    get_usage (mount);
+  std::erase_if (mounts, [](const Mount &mount) {
+    return mount.size == 0 && !mount.error;
+  });
+  return mounts;
+}
+
+std::string
+device_name (dev_t dev)
+{
+  static std::unordered_map<dev_t, std::string> S_names;
+  if (const auto it = S_names.find (dev); it != S_names.end ())
+    return it->second;
+  for (const Mount &mount : read_mountinfo ())
+    {
+      // Block devices are named after their node, other sources like tmpfs
+      // are not unique so they get the mount point.
+      const fs::path source = mount.source;
+      S_names.try_emplace (mount.dev, (source.parent_path () == "/dev"
+                                       ? source.filename ().native ()
+                                       : mount.mount_point.native ()));
+    }
+  const auto [it, inserted] = S_names.try_emplace (
+    dev, std::to_string (major (dev)) + ":" + std::to_string (minor (dev))
+  );
+  return it->second;
+}
+
+u64
+free_space (const fs::path &path)
+{
+  struct stat sb;
+  if (::stat (path.c_str (), &sb) == -1)
+    return 0;
+  const auto now = std::chrono::steady_clock::now ();
+  {
+    std::lock_guard lock (S_free_mutex);
+    const auto it = S_free.find (sb.st_dev);
+    if (it != S_free.end () && now - it->second.time < FREE_SPACE_TTL)
+      return it->second.free;
+  }
+  struct statvfs sv;
+  if (::statvfs (path.c_str (), &sv) == -1)
+    return 0;
+  const u64 free = static_cast<u64> (sv.f_bfree) * sv.f_frsize;
+  std::lock_guard lock (S_free_mutex);
+  S_free.insert_or_assign (sb.st_dev, CachedFree {free, now});
+  return free;
+}
+
+u64
+root_used_inodes (const fs::path &path)
+{
+  struct stat sb, parent;
+  if (::stat (path.c_str (), &sb) == -1
+      || ::stat ((path / "..").c_str (), &parent) == -1)
+    return 0;
+  // The parent of the root of a file system is on another device, except for
+  // / which is its own parent.
+  if (sb.st_dev == parent.st_dev && sb.st_ino != parent.st_ino)
+    return 0;
+  struct statvfs sv;
+  if (::statvfs (path.c_str (), &sv) == -1)
+    return 0;
+  return sv.f_files - sv.f_ffree;
+}
+
+void
+invalidate ()
+{
+  std::lock_guard lock (S_free_mutex);
+  S_free.clear ();
+}
+}
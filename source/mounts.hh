@@ -0,0 +1,44 @@
+#pragma once
+#include "stdafx.hh"
+
+// Mounted file systems and their usage as reported by statvfs, which is
+// cheap compared to walking them.
+namespace Mounts
+{
+struct Mount
+{
+  fs::path mount_point;
+  std::string type;
+  std::string source;
+  dev_t dev;
+  u64 size;
+  u64 free;
+  u64 available;
+  u64 inodes;
+  u64 free_inodes;
+  // errno if statvfs failed, the usage is all 0 then
+  int error;
+
+  u64 used () const { return size - free; }
+  u64 used_inodes () const { return inodes - free_inodes; }
+};
+
+// Returns the visible mounts from /proc/self/mountinfo sorted by mount point.
+// Pseudo file systems without any blocks are left out.
+std::vector<Mount> list ();
+
+// Returns a short name for the device, the name of its node in /dev or
+// where it is mounted.
+std::string device_name (dev_t dev);
+
+// Returns the free space of the file system containing `path'.  The value is
+// cached per device for a few seconds.
+u64 free_space (const fs::path &path);
+
+// Returns the number of used inodes of the file system if `path' is its root
+// and 0 otherwise, as the count says nothing about a part of the file system.
+u64 root_used_inodes (const fs::path &path);
+
+// Forgets the cached free space, after files were removed.
+void invalidate ();
+}
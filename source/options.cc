@@ -7,6 +7,30 @@ bool si = false;
 bool raw_size = false;
 int bar_length = 10;
 unsigned history_size = 16;
+bool find_duplicates = false;
+unsigned duplicates_min_size = 4;
+const char *daemon_socket = nullptr;
+const char *connect_socket = nullptr;
+unsigned refresh_interval = 300;
+unsigned scan_threads = 0;
+unsigned device_threads = 0;
+unsigned max_depth = 0;
+unsigned time_budget = 0;
+bool estimate = false;
+unsigned max_rate = 0;
+bool adaptive_rate = false;
+bool idle_io = false;
+bool bench = false;
+bool show_mounts = false;
+unsigned watch_interval = 0;
+const char *metrics_file = "spaceinfo.prom";
+const char *snapshot_file = nullptr;
+const char *snapshot_base = nullptr;
+const char *view_snapshot = nullptr;
+bool follow_symlinks = false;
+bool low_bandwidth = false;
+bool extents = false;
+unsigned extents_min = 1024;
 }
 
 const char *
@@ -17,6 +41,54 @@ parse_args (int argc, const char *const *argv)
   flag::add (Options::raw_size, "r", "Do not print human readable sizes.");
   flag::add (Options::bar_length, "bar-length", "Length for the relative size bar.");
   flag::add (Options::history_size, "hist-len", "Maximum length of search/go-to history.");
+  flag::add (Options::find_duplicates, "dupes",
+             "Remember files during the scan to find duplicates.");
+  flag::add (Options::duplicates_min_size, "dupes-min",
+             "Minimum size in KiB of files considered for duplicates.");
+  flag::add (Options::daemon_socket, "daemon",
+             "Scan the directory and serve it on the given Unix socket.");
+  flag::add (Options::connect_socket, "connect",
+             "Get directory listings from the daemon on the given socket.");
+  flag::add (Options::refresh_interval, "refresh",
+             "Seconds between rescans of the tree by the daemon.");
+  flag::add (Options::scan_threads, "j",
+             "Number of threads sizing directories, 0 for one per core.");
+  flag::add (Options::device_threads, "device-threads",
+             "Number of directories sized at once per device, 0 for no limit.");
+  flag::add (Options::max_depth, "max-depth",
+             "Only walk this many levels below a directory, 0 for no limit.");
+  flag::add (Options::time_budget, "time-budget",
+             "Stop scanning a directory after this many seconds, 0 for no limit.");
+  flag::add (Options::estimate, "estimate",
+             "Estimate subdirectory sizes from random samples of their trees.");
+  flag::add (Options::max_rate, "max-rate",
+             "Maximum number of entries scanned per second, 0 for no limit.");
+  flag::add (Options::adaptive_rate, "adaptive-rate",
+             "Slow down scanning when the latency of the file system rises.");
+  flag::add (Options::idle_io, "idle-io",
+             "Use the idle I/O scheduling class for scanning.");
+  flag::add (Options::bench, "bench",
+             "Scan the directory without the interface and print statistics.");
+  flag::add (Options::show_mounts, "mounts",
+             "Start with an overview of the mounted file systems.");
+  flag::add (Options::watch_interval, "watch",
+             "Rescan every this many seconds and write metrics, no interface.");
+  flag::add (Options::metrics_file, "metrics",
+             "File the metrics of -watch are written to.");
+  flag::add (Options::snapshot_file, "snapshot",
+             "Scan the directory and save the tree to the given file, no interface.");
+  flag::add (Options::snapshot_base, "snapshot-base",
+             "Only save the changes since this snapshot with -snapshot.");
+  flag::add (Options::view_snapshot, "view-snapshot",
+             "Browse the given snapshot instead of the file system.");
+  flag::add (Options::follow_symlinks, "L",
+             "Follow symlinks to directories, counting each directory once.");
+  flag::add (Options::low_bandwidth, "low-bandwidth",
+             "Send as little as possible to the terminal, for slow connections.");
+  flag::add (Options::extents, "extents",
+             "Tell shared from exclusive bytes of big files by their extents.");
+  flag::add (Options::extents_min, "extents-min",
+             "Minimum size in KiB of files whose extents are checked.");
 
   flag::add_help ();
 
@@ -7,6 +7,30 @@ extern bool si;
 extern bool raw_size;
 extern int bar_length;
 extern unsigned history_size;
+extern bool find_duplicates;
+extern unsigned duplicates_min_size;
+extern const char *daemon_socket;
+extern const char *connect_socket;
+extern unsigned refresh_interval;
+extern unsigned scan_threads;
+extern unsigned device_threads;
+extern unsigned max_depth;
+extern unsigned time_budget;
+extern bool estimate;
+extern unsigned max_rate;
+extern bool adaptive_rate;
+extern bool idle_io;
+extern bool bench;
+extern bool show_mounts;
+extern unsigned watch_interval;
+extern const char *metrics_file;
+extern const char *snapshot_file;
+extern const char *snapshot_base;
+extern const char *view_snapshot;
+extern bool follow_symlinks;
+extern bool low_bandwidth;
+extern bool extents;
+extern unsigned extents_min;
 }
 
 const char *
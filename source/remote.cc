@@ -0,0 +1,577 @@
+#include "remote.hh"
+#include "encoding.hh"
+#include "options.hh"
+#include "scan.hh"
+#include "mounts.hh"
+#include <csignal>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace Remote
+{
+enum Operation : u8
+{
+  LIST,
+  RELOAD
+};
+
+// Upper bound for message sizes so a broken peer cannot make us allocate
+// arbitrary amounts of memory.
+constexpr u32 MAX_MESSAGE_SIZE = 1U << 30;
+
+enum ItemFlags : u8
+{
+  DIRECTORY = 1,
+  HAS_SUMMARY = 2,
+  HAS_UNREADABLE = 4
+};
+
+static bool
+write_all (int fd, const char *data, usize size)
+{
+  while (size)
+    {
+      const ssize_t n = ::write (fd, data, size);
+      if (n == -1 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return false;
+      data += n;
+      size -= n;
+    }
+  return true;
+}
+
+static bool
+read_all (int fd, char *data, usize size)
+{
+  while (size)
+    {
+      const ssize_t n = ::read (fd, data, size);
+      if (n == -1 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return false;
+      data += n;
+      size -= n;
+    }
+  return true;
+}
+
+static bool
+send_message (int fd, const std::string &body)
+{
+  const u32 size = body.size ();
+  return (write_all (fd, reinterpret_cast<const char *> (&size), sizeof (size))
+          && write_all (fd, body.data (), body.size ()));
+}
+
+static bool
+receive_message (int fd, std::string &body)
+{
+  u32 size;
+  if (!read_all (fd, reinterpret_cast<char *> (&size), sizeof (size))
+      || size > MAX_MESSAGE_SIZE)
+    return false;
+  body.resize (size);
+  return read_all (fd, body.data (), size);
+}
+
+static sockaddr_un
+socket_address (const char *socket_path)
+{
+  sockaddr_un addr {};
+  addr.sun_family = AF_UNIX;
+  std::strncpy (addr.sun_path, socket_path, sizeof (addr.sun_path) - 1);
+  return addr;
+}
+
+// Returns a pointer to a string with the same contents that lives until the
+// end of the program, as items only store pointers to their error messages.
+static const char *
+intern_error (std::string_view error)
+{
+  static std::set<std::string, std::less<>> S_errors;
+  if (error.empty ())
+    return nullptr;
+  auto it = S_errors.find (error);
+  if (it == S_errors.end ())
+    it = S_errors.emplace (error).first;
+  return it->c_str ();
+}
+
+static bool
+decode_listing (Decoder &dec, const fs::path &path, SpaceInfo &si)
+{
+  if (const u64 error = dec.uint ())
+    {
+      G_error = std::error_code (error, std::system_category ());
+      return false;
+    }
+  file_system_free = dec.uint ();
+  si.add_parent (path.parent_path ());
+  for (u64 n = dec.uint (); n && dec.ok (); --n)
+    {
+      const u64 flags = dec.uint ();
+      const fs::path name = dec.string ();
+      const char *const error = intern_error (dec.string ());
+      struct stat sb {};
+      sb.st_mode = (flags & DIRECTORY) ? S_IFDIR : S_IFREG;
+      sb.st_size = dec.uint ();
+      const u64 file_count = dec.uint ();
+      sb.st_mtime = dec.sint ();
+      sb.st_atime = dec.sint ();
+      sb.st_uid = dec.uint ();
+      sb.st_gid = dec.uint ();
+      std::unique_ptr<Summary> summary;
+      if (flags & HAS_SUMMARY)
+        {
+          summary = std::make_unique<Summary> ();
+          summary->decode (dec);
+        }
+      if ((flags & DIRECTORY) || error)
+        si.add (path / name, sb.st_size, file_count, flags & DIRECTORY, error,
+                std::move (summary), &sb);
+      else
+        si.add_file (path / name, sb);
+      if (flags & HAS_UNREADABLE)
+        {
+          const u64 count = dec.uint ();
+          si.set_unreadable (name, count, static_cast<int> (dec.uint ()));
+        }
+    }
+  if (!dec.ok ())
+    G_error = std::make_error_code (std::errc::bad_message);
+  return dec.ok ();
+}
+
+static bool
+is_below (const fs::path &path, const fs::path &root)
+{
+  const fs::path rel = path.lexically_relative (root);
+  return !rel.empty () && *rel.begin () != "..";
+}
+
+// The tree served by the daemon.  Requests only read it, rescans build a new
+// tree or subtree without holding the lock and swap it in.
+struct Served
+{
+  std::shared_mutex mutex;
+  fs::path root;
+  Scan::Config config;
+  Scan::Node tree;
+};
+
+// Never destroyed since the detached threads may still be using it when the
+// program exits.
+static Served &S = *new Served;
+
+// Returns the nodes from the root down to the directory at `rel', which is
+// relative to the root, or an empty vector if it is not in the tree.
+static std::vector<Scan::Node *>
+find_nodes (const fs::path &rel)
+{
+  std::vector<Scan::Node *> nodes {&S.tree};
+  for (const fs::path &name : rel)
+    {
+      if (name == ".")
+        continue;
+      std::vector<Scan::Node> &children = nodes.back ()->children;
+      const auto it = std::find_if (children.begin (), children.end (),
+                                    [&name](const Scan::Node &child) {
+                                      return child.name == name;
+                                    });
+      if (it == children.end ())
+        return {};
+      nodes.push_back (&*it);
+    }
+  return nodes;
+}
+
+// Opens the directory at `rel' below the root without following symlinks,
+// so a link in the tree cannot lead outside of it.  Returns null and leaves
+// errno set on failure.
+static DIR *
+open_below (const fs::path &rel)
+{
+  DIR *dir = open_dir (AT_FDCWD, S.root.c_str (), true);
+  for (const fs::path &name : rel)
+    {
+      if (!dir || name == ".")
+        continue;
+      DIR *const sub = open_dir (::dirfd (dir), name.c_str (), false);
+      const int error = errno;
+      ::closedir (dir);
+      dir = sub;
+      errno = error;
+    }
+  return dir;
+}
+
+// Encodes the listing of the directory at `path', which is `rel' below the
+// root, from the tree and the current metadata of its entries.  Returns 0 or
+// an errno value if it cannot be listed.  The caller holds the lock.
+static int
+encode_listing (Encoder &enc, const fs::path &path, const fs::path &rel)
+{
+  const std::vector<Scan::Node *> nodes = find_nodes (rel);
+  if (nodes.empty ())
+    return ENOENT;
+  const Scan::Node &node = *nodes.back ();
+  if (node.error)
+    return node.error;
+  DIR *const dir = open_below (rel);
+  if (!dir)
+    return errno;
+  std::unordered_map<std::string_view, const Scan::Node *> children;
+  for (const Scan::Node &child : node.children)
+    children.emplace (child.name.native (), &child);
+  Encoder items;
+  u64 count = 0;
+  struct stat sb;
+  while (const struct dirent *de = ::readdir (dir))
+    {
+      if (std::strcmp (de->d_name, ".") == 0
+          || std::strcmp (de->d_name, "..") == 0)
+        continue;
+      const bool ok = ::fstatat (::dirfd (dir), de->d_name, &sb,
+                                 AT_SYMLINK_NOFOLLOW) == 0;
+      if (ok && !S_ISDIR (sb.st_mode) && !S_ISREG (sb.st_mode)
+          && !S_ISLNK (sb.st_mode))
+        continue;
+      // Directories created since the last scan are listed as empty
+      const auto it = children.find (de->d_name);
+      const Scan::Node *const child = (ok && S_ISDIR (sb.st_mode)
+                                       && it != children.end ()
+                                       ? it->second : nullptr);
+      const char *error = nullptr;
+      if (!ok)
+        error = std::strerror (errno);
+      else if (child && child->error)
+        error = std::strerror (child->error);
+      items.uint ((ok && S_ISDIR (sb.st_mode) ? DIRECTORY : 0)
+                  | (child && child->summary ? HAS_SUMMARY : 0)
+                  | (child && child->unreadable ? HAS_UNREADABLE : 0));
+      items.string (de->d_name);
+      items.string (error ? error : "");
+      if (!ok)
+        {
+          items.uint (0);
+          items.uint (0);
+        }
+      else if (S_ISDIR (sb.st_mode))
+        {
+          items.uint (child ? child->size : 0);
+          items.uint (child ? child->file_count : 0);
+        }
+      else
+        {
+          items.uint (sb.st_size);
+          items.uint (1);
+        }
+      items.sint (ok ? sb.st_mtime : 0);
+      items.sint (ok ? sb.st_atime : 0);
+      items.uint (ok ? sb.st_uid : 0);
+      items.uint (ok ? sb.st_gid : 0);
+      if (child && child->summary)
+        child->summary->encode (items);
+      if (child && child->unreadable)
+        {
+          items.uint (child->unreadable);
+          items.uint (child->read_error);
+        }
+      ++count;
+    }
+  ::closedir (dir);
+  enc.uint (0);
+  enc.uint (Mounts::free_space (path));
+  enc.uint (count);
+  enc.raw (items.data ());
+  return 0;
+}
+
+// Scans the whole tree again and swaps it in.  Returns false and sets
+// `G_error' if the root cannot be read.
+static bool
+scan_tree ()
+{
+  Scan::Handle scan (S.root, S.config);
+  if (scan.run () == ScanStatus::Failed)
+    {
+      G_error = scan.error ();
+      return false;
+    }
+  Scan::Node tree = scan.take_root ();
+  std::unique_lock lock (S.mutex);
+  std::swap (S.tree, tree);
+  return true;
+}
+
+// Adds the totals of `node' to the ancestors in `nodes', or takes them off.
+static void
+update_ancestors (const std::vector<Scan::Node *> &nodes,
+                  const Scan::Node &node, bool add)
+{
+  for (Scan::Node *const ancestor : nodes)
+    if (add)
+      {
+        ancestor->size += node.size;
+        ancestor->file_count += node.file_count;
+        ancestor->unreadable += node.unreadable;
+        if (ancestor->summary && node.summary)
+          ancestor->summary->merge (*node.summary);
+      }
+    else
+      {
+        ancestor->size -= node.size;
+        ancestor->file_count -= node.file_count;
+        ancestor->unreadable -= node.unreadable;
+        if (ancestor->summary && node.summary)
+          ancestor->summary->subtract (*node.summary);
+      }
+}
+
+// Rescans the directory at `path', which is `rel' below the root, and puts
+// it into the tree with its ancestors updated.  A directory that is gone is
+// taken out of the tree, one that cannot be read keeps its old subtree.
+static void
+rescan (const fs::path &path, const fs::path &rel)
+{
+  if (rel == ".")
+    {
+      scan_tree ();
+      return;
+    }
+  Scan::Handle scan (path, S.config);
+  const bool failed = scan.run () == ScanStatus::Failed;
+  const int error = scan.error ().value ();
+  if (failed && error != ENOENT && error != ENOTDIR)
+    return;
+  Scan::Node fresh;
+  if (!failed)
+    fresh = scan.take_root ();
+  std::unique_lock lock (S.mutex);
+  std::vector<Scan::Node *> nodes = find_nodes (rel.parent_path ());
+  if (nodes.empty ())
+    return;
+  std::vector<Scan::Node> &siblings = nodes.back ()->children;
+  const auto it = std::find_if (siblings.begin (), siblings.end (),
+                                [&rel](const Scan::Node &child) {
+                                  return child.name == rel.filename ();
+                                });
+  if (it != siblings.end ())
+    {
+      update_ancestors (nodes, *it, false);
+      siblings.erase (it);
+    }
+  if (failed)
+    return;
+  update_ancestors (nodes, fresh, true);
+  fresh.name = rel.filename ();
+  siblings.push_back (std::move (fresh));
+}
+
+// Rescans one of the directories in the root, the one that went the longest
+// without a rescan, so each refresh only walks a part of the tree.
+// `rescanned' holds the tick each of them was last rescanned at, it is only
+// used by the refresh thread.
+static void
+refresh_stalest (std::map<std::string, u64> &rescanned, u64 tick)
+{
+  // Directories created or removed since the last refresh are rescanned too
+  std::set<std::string> names;
+  if (DIR *const dir = open_below ("."))
+    {
+      struct stat sb;
+      while (const struct dirent *de = ::readdir (dir))
+        if (std::strcmp (de->d_name, ".") != 0
+            && std::strcmp (de->d_name, "..") != 0
+            && ::fstatat (::dirfd (dir), de->d_name, &sb,
+                          AT_SYMLINK_NOFOLLOW) == 0
+            && S_ISDIR (sb.st_mode))
+          names.insert (de->d_name);
+      ::closedir (dir);
+    }
+  {
+    std::shared_lock lock (S.mutex);
+    for (const Scan::Node &child : S.tree.children)
+      names.insert (child.name.native ());
+  }
+  std::erase_if (rescanned, [&names](const auto &entry) {
+    return !names.contains (entry.first);
+  });
+  const std::string *stalest = nullptr;
+  u64 oldest = tick;
+  for (const std::string &name : names)
+    {
+      const auto it = rescanned.find (name);
+      const u64 last = it != rescanned.end () ? it->second : 0;
+      if (last < oldest)
+        {
+          stalest = &name;
+          oldest = last;
+        }
+    }
+  if (!stalest)
+    return;
+  rescan (S.root / *stalest, *stalest);
+  rescanned[*stalest] = tick;
+}
+
+// Handles a request on the daemon side, returns false if it was malformed.
+static bool
+handle_request (const std::string &request, std::string &response)
+{
+  Decoder dec (request);
+  const u64 operation = dec.uint ();
+  fs::path path = fs::path (dec.string ()).lexically_normal ();
+  if (!dec.ok () || operation > RELOAD)
+    return false;
+  Encoder enc;
+  std::error_code error;
+  // Symlinks could lead outside of the root
+  if (path.is_absolute ())
+    path = fs::canonical (path, error);
+  if (!path.is_absolute () || error || !is_below (path, S.root))
+    enc.uint (error ? error.value () : EACCES);
+  else
+    {
+      const fs::path rel = path.lexically_relative (S.root);
+      if (operation == RELOAD)
+        rescan (path, rel);
+      std::shared_lock lock (S.mutex);
+      if (const int e = encode_listing (enc, path, rel))
+        {
+          enc.clear ();
+          enc.uint (e);
+        }
+    }
+  response = std::move (enc.data ());
+  return true;
+}
+
+// Answers the requests of one client until it disconnects.
+static void
+serve_client (int fd)
+{
+  std::string request, response;
+  while (receive_message (fd, request)
+         && handle_request (request, response)
+         && send_message (fd, response))
+    ;
+  ::close (fd);
+}
+
+int
+serve (const char *socket_path, const fs::path &root)
+{
+  std::signal (SIGPIPE, SIG_IGN);
+  const sockaddr_un addr = socket_address (socket_path);
+  const int listen_fd = ::socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  ::unlink (socket_path);
+  // Only the owner may connect, the listings show everything below the root
+  const mode_t mask = ::umask (0077);
+  const bool bound = (listen_fd != -1
+                      && ::bind (listen_fd,
+                                 reinterpret_cast<const sockaddr *> (&addr),
+                                 sizeof (addr)) == 0);
+  ::umask (mask);
+  if (!bound || ::listen (listen_fd, 16) == -1)
+    {
+      std::fprintf (stderr, "%s: %s\n", socket_path, std::strerror (errno));
+      return 1;
+    }
+
+  S.root = root;
+  S.config.tree_depth = 0;
+  S.config.max_depth = Options::max_depth;
+  S.config.follow_symlinks = Options::follow_symlinks;
+  S.config.keep_summaries = true;
+  if (!scan_tree ())
+    {
+      std::fprintf (stderr, "%s: %s\n", root.c_str (),
+                    G_error.message ().c_str ());
+      return 1;
+    }
+
+  // Clients cannot hold up the refreshes, they run on their own thread
+  std::thread ([interval = std::max (1U, Options::refresh_interval)]() {
+    std::map<std::string, u64> rescanned;
+    for (u64 tick = 1;; ++tick)
+      {
+        std::this_thread::sleep_for (std::chrono::seconds (interval));
+        refresh_stalest (rescanned, tick);
+      }
+  }).detach ();
+
+  for (;;)
+    {
+      const int client = ::accept4 (listen_fd, nullptr, nullptr,
+                                    SOCK_CLOEXEC);
+      if (client != -1)
+        std::thread (serve_client, client).detach ();
+      else if (errno != EINTR && errno != ECONNABORTED)
+        {
+          std::perror ("accept");
+          return 1;
+        }
+    }
+}
+
+static int
+connect_to (const char *socket_path)
+{
+  const sockaddr_un addr = socket_address (socket_path);
+  const int fd = ::socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+    return -1;
+  if (::connect (fd, reinterpret_cast<const sockaddr *> (&addr),
+                 sizeof (addr)) == -1)
+    {
+      ::close (fd);
+      return -1;
+    }
+  return fd;
+}
+
+SpaceInfo *
+fetch (const char *socket_path, const fs::path &path, bool reload)
+{
+  static int S_fd = -1;
+  if (!reload && G_dirs.contains (path))
+    return &G_dirs[path];
+
+  Encoder enc;
+  enc.uint (reload ? RELOAD : LIST);
+  enc.string (path.native ());
+  std::string response;
+  // Retry once with a new connection in case the daemon was restarted.
+  bool ok = false;
+  for (int attempt = 0; attempt < 2 && !ok; ++attempt)
+    {
+      if (S_fd == -1 && (S_fd = connect_to (socket_path)) == -1)
+        break;
+      ok = (send_message (S_fd, enc.data ())
+            && receive_message (S_fd, response));
+      if (!ok)
+        {
+          ::close (S_fd);
+          S_fd = -1;
+        }
+    }
+  if (!ok)
+    {
+      G_error = std::error_code (errno ? errno : ECONNRESET,
+                                 std::system_category ());
+      return nullptr;
+    }
+
+  SpaceInfo si;
+  Decoder dec (response);
+  if (!decode_listing (dec, path, si))
+    return nullptr;
+  return &G_dirs.insert_or_assign (path, std::move (si)).first->second;
+}
+}
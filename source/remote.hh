@@ -0,0 +1,24 @@
+#pragma once
+#include "stdafx.hh"
+#include "space_info.hh"
+
+// Sharing scan results between processes over a Unix socket.
+//
+// Every message is a 32-bit length followed by the varint encoded body.  A
+// request is the operation and the path, the response is an errno value and
+// if that is 0 the free space and the items of the directory.
+namespace Remote
+{
+// Scans the whole tree at `root' once and serves directory listings below it
+// on the given socket until the process is killed.  Every client gets its own
+// thread.  Every `Options::refresh_interval' seconds one directory in the
+// root gets rescanned in the background, the one rescanned the longest ago.
+// Only the owner can connect to the socket.
+int serve (const char *socket_path, const fs::path &root);
+
+// Gets the listing of the given directory from the daemon listening on the
+// given socket and caches it in `G_dirs'.  If `reload' is set the daemon
+// rescans the directory first.  Returns nullptr and sets `G_error' on error.
+SpaceInfo * fetch (const char *socket_path, const fs::path &path,
+                   bool reload = false);
+}
@@ -0,0 +1,320 @@
+#include "remove.hh"
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace Remove
+{
+// Maximum number of workers used for a single removal.
+constexpr unsigned MAX_WORKERS = 8;
+
+struct Job
+{
+  fs::path path;
+  std::atomic<u64> size = 0;
+  std::atomic<u64> file_count = 0;
+  std::atomic<int> error = 0;
+  std::atomic<bool> done = false;
+  std::thread thread;
+};
+
+static std::list<Job> S_jobs;
+// Makes all removals stop early when set
+static std::atomic<bool> S_cancel = false;
+
+static void
+set_error (Job &job, int error)
+{
+  int expected = 0;
+  job.error.compare_exchange_strong (expected, error);
+}
+
+static bool
+is_directory (int dir_fd, const struct dirent *de)
+{
+  struct stat sb;
+  if (de->d_type != DT_UNKNOWN)
+    return de->d_type == DT_DIR;
+  return (::fstatat (dir_fd, de->d_name, &sb, AT_SYMLINK_NOFOLLOW) == 0
+          && S_ISDIR (sb.st_mode));
+}
+
+static void
+remove_file (Job &job, int dir_fd, const char *name)
+{
+  struct stat sb;
+  if (::fstatat (dir_fd, name, &sb, AT_SYMLINK_NOFOLLOW) == -1)
+    return set_error (job, errno);
+  if (::unlinkat (dir_fd, name, 0) == -1)
+    return set_error (job, errno);
+  // The data stays around as long as there are other links to it
+  if (sb.st_nlink == 1)
+    job.size += sb.st_size;
+  ++job.file_count;
+}
+
+// A directory on the way down to the one being emptied, with the
+// subdirectories that are still to be removed.
+struct Level
+{
+  std::string name;
+  dev_t dev;
+  ino_t ino;
+  std::vector<std::string> subdirs;
+};
+
+// Opens the subdirectory `name' without following symlinks.
+static int
+open_subdir (int dir_fd, const char *name)
+{
+  return ::openat (dir_fd, name,
+                   O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+}
+
+// Whether the open directory is the one seen at `level'.
+static bool
+is_level (int fd, const Level &level)
+{
+  struct stat sb;
+  return (::fstat (fd, &sb) == 0 && sb.st_dev == level.dev
+          && sb.st_ino == level.ino);
+}
+
+// Opens the parent of the directory open as `dir', which is the last one of
+// `levels'.  If the directory was moved meanwhile the parent is found from
+// `top_fd' by the names on the way down instead.  Returns null and leaves
+// errno set on failure.
+static DIR *
+open_parent (DIR *dir, int top_fd, const std::vector<Level> &levels)
+{
+  int fd = ::openat (::dirfd (dir), "..",
+                     O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd != -1 && !is_level (fd, levels.back ()))
+    {
+      ::close (fd);
+      fd = -1;
+    }
+  if (fd == -1)
+    {
+      fd = top_fd;
+      for (const Level &level : levels)
+        {
+          const int sub = open_subdir (fd, level.name.c_str ());
+          if (fd != top_fd)
+            ::close (fd);
+          if (sub != -1 && !is_level (sub, level))
+            {
+              ::close (sub);
+              errno = ENOENT;
+              return nullptr;
+            }
+          if ((fd = sub) == -1)
+            return nullptr;
+        }
+    }
+  DIR *const parent = ::fdopendir (fd);
+  if (!parent)
+    ::close (fd);
+  return parent;
+}
+
+// Removes the directory `name' in `top_fd' and everything in it.  Works down
+// the tree with a stack of directory names instead of recursing, so only the
+// directory being emptied is open however deep the tree is.
+static void
+remove_tree (Job &job, int top_fd, const char *name)
+{
+  std::vector<Level> levels;
+  DIR *dir = nullptr;
+  // Opens the subdirectory, removes the files in it and makes it the
+  // current directory with its subdirectories left to do
+  const auto enter = [&](int parent_fd, std::string subdir) {
+    const int fd = open_subdir (parent_fd, subdir.c_str ());
+    DIR *const sub = fd == -1 ? nullptr : ::fdopendir (fd);
+    struct stat sb;
+    if (!sub || ::fstat (fd, &sb) == -1)
+      {
+        set_error (job, errno);
+        if (sub)
+          ::closedir (sub);
+        else if (fd != -1)
+          ::close (fd);
+        return;
+      }
+    Level level {std::move (subdir), sb.st_dev, sb.st_ino, {}};
+    while (const struct dirent *de = ::readdir (sub))
+      {
+        if (S_cancel)
+          break;
+        if (std::strcmp (de->d_name, ".") == 0
+            || std::strcmp (de->d_name, "..") == 0)
+          continue;
+        if (is_directory (fd, de))
+          level.subdirs.emplace_back (de->d_name);
+        else
+          remove_file (job, fd, de->d_name);
+      }
+    if (dir)
+      ::closedir (dir);
+    dir = sub;
+    levels.push_back (std::move (level));
+  };
+
+  enter (top_fd, name);
+  while (!levels.empty ())
+    {
+      std::vector<std::string> &subdirs = levels.back ().subdirs;
+      if (!S_cancel && !subdirs.empty ())
+        {
+          std::string subdir = std::move (subdirs.back ());
+          subdirs.pop_back ();
+          enter (::dirfd (dir), std::move (subdir));
+          continue;
+        }
+      // Done with the current directory, it gets removed from its parent
+      const std::string done = std::move (levels.back ().name);
+      levels.pop_back ();
+      int parent_fd = top_fd;
+      DIR *const parent = (levels.empty () ? nullptr
+                           : open_parent (dir, top_fd, levels));
+      if (!levels.empty () && !parent)
+        {
+          set_error (job, errno);
+          break;
+        }
+      ::closedir (dir);
+      dir = parent;
+      if (parent)
+        parent_fd = ::dirfd (parent);
+      if (::unlinkat (parent_fd, done.c_str (), AT_REMOVEDIR) == -1)
+        set_error (job, errno);
+    }
+  if (dir)
+    ::closedir (dir);
+}
+
+// Removes the entries of the job's directory on multiple workers, then the
+// directory itself.
+static void
+run (Job &job)
+{
+  const fs::path parent = job.path.parent_path ();
+  const std::string name = job.path.filename ().native ();
+  const int parent_fd = ::open (parent.c_str (),
+                                O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  struct stat sb;
+  if (parent_fd == -1)
+    set_error (job, errno);
+  else if (::fstatat (parent_fd, name.c_str (), &sb, AT_SYMLINK_NOFOLLOW) == -1)
+    set_error (job, errno);
+  else if (!S_ISDIR (sb.st_mode))
+    remove_file (job, parent_fd, name.c_str ());
+  else
+    {
+      const int fd = ::openat (parent_fd, name.c_str (),
+                               O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+      DIR *const dir = fd == -1 ? nullptr : ::fdopendir (fd);
+      if (!dir)
+        {
+          set_error (job, errno);
+          if (fd != -1)
+            ::close (fd);
+        }
+      else
+        {
+          std::vector<std::pair<std::string, bool>> entries;
+          while (const struct dirent *de = ::readdir (dir))
+            if (std::strcmp (de->d_name, ".") != 0
+                && std::strcmp (de->d_name, "..") != 0)
+              entries.emplace_back (de->d_name, is_directory (fd, de));
+          std::atomic<usize> next = 0;
+          auto worker = [&]() {
+            for (usize i; !S_cancel && (i = next++) < entries.size ();)
+              {
+                if (entries[i].second)
+                  remove_tree (job, fd, entries[i].first.c_str ());
+                else
+                  remove_file (job, fd, entries[i].first.c_str ());
+              }
+          };
+          const usize n_workers = std::min<usize> (
+            std::clamp (std::thread::hardware_concurrency (), 1U, MAX_WORKERS),
+            entries.size ());
+          std::vector<std::thread> workers;
+          for (usize i = 1; i < n_workers; ++i)
+            workers.emplace_back (worker);
+          worker ();
+          for (std::thread &t : workers)
+            t.join ();
+          ::closedir (dir);
+          if (::unlinkat (parent_fd, name.c_str (), AT_REMOVEDIR) == -1)
+            set_error (job, errno);
+        }
+    }
+  if (parent_fd != -1)
+    ::close (parent_fd);
+  job.done = true;
+}
+
+void
+start (const fs::path &path)
+{
+  Job &job = S_jobs.emplace_back ();
+  job.path = path;
+  job.thread = std::thread (run, std::ref (job));
+}
+
+bool
+busy ()
+{
+  return !S_jobs.empty ();
+}
+
+bool
+in_progress (const fs::path &path)
+{
+  return std::any_of (S_jobs.begin (), S_jobs.end (), [&path](const Job &job) {
+    return job.path == path;
+  });
+}
+
+u64
+progress ()
+{
+  u64 total = 0;
+  for (const Job &job : S_jobs)
+    total += job.size;
+  return total;
+}
+
+std::vector<Result>
+finished ()
+{
+  std::vector<Result> results;
+  for (auto it = S_jobs.begin (); it != S_jobs.end ();)
+    {
+      if (!it->done)
+        {
+          ++it;
+          continue;
+        }
+      it->thread.join ();
+      std::error_code error;
+      if (it->error)
+        error = std::error_code (it->error, std::system_category ());
+      results.emplace_back (std::move (it->path), it->size, it->file_count,
+                            error);
+      it = S_jobs.erase (it);
+    }
+  return results;
+}
+
+void
+shutdown ()
+{
+  S_cancel = true;
+  for (Job &job : S_jobs)
+    job.thread.join ();
+  S_jobs.clear ();
+}
+}
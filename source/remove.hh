@@ -0,0 +1,34 @@
+#pragma once
+#include "stdafx.hh"
+
+namespace Remove
+{
+struct Result
+{
+  fs::path path;
+  // Bytes and files that were actually removed
+  u64 size;
+  u64 file_count;
+  // Set if not everything could be removed
+  std::error_code error;
+};
+
+// Starts removing the given file or directory tree in the background.
+void start (const fs::path &path);
+
+// Returns whether any removals are still running.
+bool busy ();
+
+// Returns whether the given path is currently being removed.
+bool in_progress (const fs::path &path);
+
+// Returns the number of bytes removed by all running removals so far.
+u64 progress ();
+
+// Returns the results of all removals that finished since the last call.
+std::vector<Result> finished ();
+
+// Stops all running removals where they are and waits for them, what was
+// removed so far stays removed.  Must be called before exiting.
+void shutdown ();
+}
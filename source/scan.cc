@@ -0,0 +1,219 @@
+#include "scan.hh"
+#include <fcntl.h>
+
+namespace Scan
+{
+// How often the progress gets reported and the limits get checked while
+// listing the directories kept in the tree
+static constexpr u64 CHECK_INTERVAL = 256;
+
+// Counts `count' unreadable entries below `node'.
+static void
+add_unreadable (Node &node, u64 count, int error)
+{
+  if (count && !node.unreadable)
+    node.read_error = error;
+  node.unreadable += count;
+}
+
+static void
+visit_node (const Visitor &visit, const fs::path &path, const Node &node,
+            unsigned depth)
+{
+  if (!visit (path, node, depth))
+    return;
+  for (const Node &child : node.children)
+    visit_node (visit, path / child.name, child, depth + 1);
+}
+
+Handle::Handle (fs::path root, Config config)
+  : root_path_ (std::move (root)), config_ (std::move (config))
+{
+}
+
+ScanStatus
+Handle::run (const ProgressCallback &progress)
+{
+  Age::set_now (std::time (nullptr));
+  limits_ = {};
+  limits_.max_depth = config_.max_depth;
+  if (config_.time_budget.count ())
+    limits_.deadline = std::chrono::steady_clock::now () + config_.time_budget;
+  status_ = ScanStatus::Complete;
+  root_ = {};
+  root_.name = root_path_;
+  summary_ = {};
+  error_ = {};
+  done_ = {};
+  path_ = root_path_.native ();
+  visited_.clear ();
+  // The root itself may be a symlink, like for `directory_size_and_file_count'
+  DIR *const dir = open_dir (AT_FDCWD, path_.c_str (), true);
+  if (!dir)
+    {
+      error_ = std::error_code (errno, std::system_category ());
+      return status_ = ScanStatus::Failed;
+    }
+  if (config_.follow_symlinks)
+    visited_.enter (dir);
+  callback_ = &progress;
+  list (root_, dir, 0);
+  ::closedir (dir);
+  summary_.shrink ();
+  report ();
+  callback_ = nullptr;
+  return status_;
+}
+
+void
+Handle::for_each (const Visitor &visit) const
+{
+  visit_node (visit, root_.name, root_, 0);
+}
+
+void
+Handle::list (Node &node, DIR *dir, unsigned depth)
+{
+  const usize length = path_.size ();
+  DirEntry entry;
+  struct stat target;
+  if (config_.keep_summaries)
+    node.summary = std::make_unique<Summary> ();
+  while (!progress_.cancel)
+    {
+      if (!read_entry (dir, config_.follow_symlinks, entry))
+        {
+          if (errno)
+            add_unreadable (node, 1, errno);
+          break;
+        }
+      if (++done_.entries % CHECK_INTERVAL == 0)
+        {
+          report ();
+          if (std::chrono::steady_clock::now () >= limits_.deadline)
+            {
+              status_ = ScanStatus::Truncated;
+              break;
+            }
+        }
+      if (entry.error)
+        {
+          add_unreadable (node, 1, entry.error);
+          continue;
+        }
+      if (!entry.is_directory)
+        {
+          const struct stat &sb = entry.sb;
+          if (S_ISREG (sb.st_mode) || S_ISLNK (sb.st_mode))
+            {
+              summary_.add_file (entry.name, sb);
+              if (node.summary)
+                node.summary->add_file (entry.name, sb);
+              node.size += sb.st_size;
+              ++node.file_count;
+              done_.size += sb.st_size;
+              ++done_.file_count;
+              if (config_.file && S_ISREG (sb.st_mode))
+                config_.file (fs::path (path_) / entry.name, sb);
+              if (config_.keep_files)
+                node.files.emplace_back (entry.name, sb.st_size,
+                                         sb.st_mtime);
+            }
+          continue;
+        }
+      if (config_.max_depth && depth + 1 > config_.max_depth)
+        {
+          status_ = ScanStatus::Truncated;
+          continue;
+        }
+      // Already counted through another link
+      if (config_.follow_symlinks
+          && ::fstatat (::dirfd (dir), entry.name, &target, 0) == 0
+          && !visited_.enter (target))
+        continue;
+      Node &child = node.children.emplace_back ();
+      child.name = entry.name;
+      if (path_.back () != '/')
+        path_ += '/';
+      path_ += entry.name;
+      if (config_.tree_depth && depth + 1 >= config_.tree_depth)
+        walk (child, depth + 1);
+      else if (DIR *const sub = open_dir (::dirfd (dir), entry.name,
+                                          entry.is_link))
+        {
+          list (child, sub, depth + 1);
+          ::closedir (sub);
+        }
+      else
+        child.error = errno;
+      path_.resize (length);
+      if (node.summary && child.summary)
+        node.summary->merge (*child.summary);
+      node.size += child.size;
+      node.file_count += child.file_count;
+      if (child.error)
+        add_unreadable (node, 1, child.error);
+      else
+        add_unreadable (node, child.unreadable, child.read_error);
+    }
+  if (progress_.cancel)
+    status_ = ScanStatus::Truncated;
+  if (node.summary)
+    node.summary->shrink ();
+  std::sort (node.children.begin (), node.children.end (),
+             [](const Node &a, const Node &b) {
+               return (a.size == b.size
+                       ? a.name.native () < b.name.native ()
+                       : a.size > b.size);
+             });
+}
+
+void
+Handle::walk (Node &node, unsigned depth)
+{
+  // The walk counts levels from the directory it starts at
+  ScanLimits limits = limits_;
+  if (limits.max_depth)
+    limits.max_depth -= depth - 1;
+  ScanHooks hooks;
+  hooks.file = config_.file;
+  if (config_.follow_symlinks)
+    hooks.follow = &visited_;
+  hooks.progress = [this](const ScanProgress &) { report (); };
+  Summary summary;
+  ScanErrors errors;
+  const ScanStatus status = directory_size_and_file_count (
+    path_, node.size, node.file_count, summary, errors, limits, &progress_,
+    &hooks
+  );
+  if (status == ScanStatus::Failed)
+    {
+      node.size = node.file_count = 0;
+      node.error = errors.first;
+    }
+  else
+    {
+      summary_.merge (summary);
+      if (config_.keep_summaries)
+        node.summary = std::make_unique<Summary> (std::move (summary));
+      add_unreadable (node, errors.count, errors.first);
+      if (status == ScanStatus::Truncated)
+        status_ = ScanStatus::Truncated;
+    }
+  done_.size += node.size;
+  done_.file_count += node.file_count;
+  done_.entries += progress_.entries;
+  progress_.size = 0;
+  progress_.file_count = 0;
+  progress_.entries = 0;
+}
+
+void
+Handle::report ()
+{
+  if (callback_ && *callback_)
+    (*callback_) ({done_.size + progress_.size,
+                   done_.file_count + progress_.file_count,
+                   done_.entries + progress_.entries});
+}
+}
@@ -0,0 +1,136 @@
+#pragma once
+#include "stdafx.hh"
+#include "summary.hh"
+#include "walk.hh"
+
+// The scan engine for use in other programs, built into libspaceinfo.  A
+// scan only touches the state of its handle, so any number of handles can
+// scan at the same time on different threads.  The only state shared with
+// the rest of the process is the `Throttle', which does not limit anything
+// unless configured, and the point in time ages are measured from.
+namespace Scan
+{
+struct Config
+{
+  // Levels of subdirectories kept as nodes of the tree, deeper directories
+  // only count towards their ancestors.  0 keeps the whole tree.
+  unsigned tree_depth = 1;
+  // Levels below the root that get walked, 0 for no limit
+  unsigned max_depth = 0;
+  // Stops the scan after this long, 0 for no limit
+  std::chrono::milliseconds time_budget {0};
+  // Called for every regular file with its full path
+  std::function<void (const fs::path &, const struct stat &)> file;
+  // Keeps the files of the directories in the tree as well, files in deeper
+  // directories are never kept.
+  bool keep_files = false;
+  // Follows symlinks to directories, counting every directory once
+  bool follow_symlinks = false;
+  // Keeps the summary of every node of the tree, not only of the whole tree
+  bool keep_summaries = false;
+};
+
+// A file kept with `Config::keep_files', symlinks count as files
+struct File
+{
+  std::string name;
+  u64 size;
+  time_t mtime;
+};
+
+// A directory of the scanned tree, the sizes include everything below it.
+struct Node
+{
+  // The full path for the root and the file name for all other nodes
+  fs::path name;
+  u64 size = 0;
+  u64 file_count = 0;
+  // Number of entries below the directory that could not be read and the
+  // errno of the first of them
+  u64 unreadable = 0;
+  int read_error = 0;
+  // errno if the directory itself could not be read
+  int error = 0;
+  // Subdirectories kept in the tree, biggest first
+  std::vector<Node> children;
+  // Files directly in the directory in no particular order
+  std::vector<File> files;
+  // Everything below the directory, only set with `Config::keep_summaries'
+  std::unique_ptr<Summary> summary;
+};
+
+// Totals of a running scan
+struct Progress
+{
+  u64 size;
+  u64 file_count;
+  // Directory entries looked at
+  u64 entries;
+};
+
+using ProgressCallback = std::function<void (const Progress &)>;
+
+// Called for each node with its full path and its depth below the root,
+// returning false skips the children of the node.
+using Visitor
+  = std::function<bool (const fs::path &, const Node &, unsigned depth)>;
+
+class Handle
+{
+public:
+  explicit Handle (fs::path root, Config config = {});
+
+  Handle (const Handle &) = delete;
+  Handle & operator= (const Handle &) = delete;
+
+  // Scans the tree on the calling thread, calling `progress' on it every
+  // few hundred entries.  If the root cannot be read the status is Failed
+  // and `error' tells why.  Running it again rescans the tree.
+  ScanStatus run (const ProgressCallback &progress = nullptr);
+
+  // Makes the running scan stop early with the status Truncated, the only
+  // method that may be called while `run' is busy on another thread.  The
+  // handle stays cancelled until `reset_cancel' is called.
+  void cancel () { progress_.cancel = true; }
+  void reset_cancel () { progress_.cancel = false; }
+
+  const Node & root () const { return root_; }
+  // Moves the tree out of the handle, which is left with an empty root
+  // until it runs again.
+  Node take_root () { return std::exchange (root_, {}); }
+  // File types, ages and owners of the whole tree
+  const Summary & summary () const { return summary_; }
+  std::error_code error () const { return error_; }
+
+  // Visits the nodes of the tree depth first, parents before children.
+  void for_each (const Visitor &visit) const;
+
+private:
+  // Lists the directory open in `dir' into `node', which is at `depth'
+  // levels below the root, and sizes its subdirectories.
+  void list (Node &node, DIR *dir, unsigned depth);
+
+  // Sizes the directory at `path_' into `node' with a single walk.
+  void walk (Node &node, unsigned depth);
+
+  void report ();
+
+  fs::path root_path_;
+  Config config_;
+  ScanLimits limits_ {};
+  ScanStatus status_ {ScanStatus::Complete};
+  Node root_ {};
+  Summary summary_ {};
+  std::error_code error_ {};
+  // Counters of the walk in progress, the cancel flag is shared by all of
+  // them
+  ScanProgress progress_ {};
+  // Totals of everything but the walk in progress
+  Progress done_ {};
+  const ProgressCallback *callback_ {nullptr};
+  // Path of the directory being listed
+  std::string path_ {};
+  // Directories entered so far when following symlinks
+  VisitedDirs visited_ {};
+};
+}
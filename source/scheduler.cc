@@ -0,0 +1,355 @@
+#include "scheduler.hh"
+#include "options.hh"
+#include "estimate.hh"
+#include "duplicates.hh"
+#include <condition_variable>
+
+namespace Scheduler
+{
+struct Task
+{
+  fs::path dir;
+  fs::path name;
+  u64 scan_id;
+  dev_t dev;
+  ScanLimits limits;
+  // Shared by the tasks of one scan following symlinks
+  std::shared_ptr<VisitedDirs> visited;
+  std::shared_ptr<ExtentMap> extents;
+  ScanProgress progress;
+  // Set if the directory is no longer interested in the result
+  std::atomic<bool> discard = false;
+  // Kept between the slices of an estimating task
+  std::unique_ptr<Estimator> estimator = nullptr;
+};
+
+using TaskPtr = std::shared_ptr<Task>;
+using Queue = std::list<TaskPtr>;
+using Clock = std::chrono::steady_clock;
+
+struct Device
+{
+  unsigned running = 0;
+  // Directory entries looked at by the finished tasks
+  u64 entries = 0;
+  // Time spent with running tasks, without the current stretch
+  Clock::duration busy {};
+  // Start of the current stretch with running tasks
+  Clock::time_point active_since;
+};
+
+struct State
+{
+  std::mutex mutex;
+  // Signaled when tasks are queued
+  std::condition_variable queued_cv;
+  // Signaled when a task finishes
+  std::condition_variable finished_cv;
+  Queue queue;
+  std::map<std::pair<fs::path, fs::path>, Queue::iterator> queued;
+  std::vector<TaskPtr> running;
+  std::vector<Result> finished;
+  // Directory entries looked at by the finished tasks of each directory
+  std::map<fs::path, u64> entries;
+  std::map<dev_t, Device> devices;
+  unsigned workers = 0;
+};
+
+// Never destroyed since the detached workers may still be using it when the
+// program exits.
+static State &S = *new State;
+
+// How long an estimating task runs before it goes to the back of the queue so
+// all subdirectories get refined at the same time.
+static constexpr auto ESTIMATE_SLICE = std::chrono::milliseconds (100);
+
+// Estimates are only accepted once they are based on this many walks and
+// their margin is at most 1/ESTIMATE_PRECISION of the size.
+static constexpr u64 ESTIMATE_MIN_WALKS = 64;
+static constexpr u64 ESTIMATE_PRECISION = 100;
+
+static void
+publish_estimate (Task &task, Result &result)
+{
+  const Estimator::Estimate e = task.estimator->estimate ();
+  task.progress.size = result.size = e.size;
+  task.progress.file_count = result.file_count = e.file_count;
+  task.progress.margin = result.margin = e.margin;
+  result.status = e.exact ? ScanStatus::Complete : ScanStatus::Estimated;
+}
+
+// Refines the estimate of the task for one slice.  Returns whether the
+// estimate is done, either because it is good enough or the task got stopped.
+static bool
+refine_estimate (Task &task, Result &result)
+{
+  using Clock = std::chrono::steady_clock;
+  if (!task.estimator)
+    task.estimator = std::make_unique<Estimator> (task.dir / task.name);
+  const Clock::time_point until = std::min (Clock::now () + ESTIMATE_SLICE,
+                                            task.limits.deadline);
+  if (!task.estimator->run (until, task.progress.cancel))
+    {
+      result.status = ScanStatus::Failed;
+      result.errors.add (errno);
+      return true;
+    }
+  publish_estimate (task, result);
+  const Estimator::Estimate e = task.estimator->estimate ();
+  return (e.exact
+          || task.progress.cancel
+          || Clock::now () >= task.limits.deadline
+          || (e.walks >= ESTIMATE_MIN_WALKS
+              && e.margin * ESTIMATE_PRECISION <= e.size));
+}
+
+// Returns the first queued task whose device has not used up its budget of
+// concurrent tasks.
+static Queue::iterator
+next_task ()
+{
+  if (!Options::device_threads)
+    return S.queue.begin ();
+  return std::find_if (S.queue.begin (), S.queue.end (),
+                       [](const TaskPtr &task) {
+                         return (S.devices[task->dev].running
+                                 < Options::device_threads);
+                       });
+}
+
+static void
+worker ()
+{
+  std::unique_lock lock (S.mutex);
+  for (;;)
+    {
+      S.queued_cv.wait (lock, []() { return next_task () != S.queue.end (); });
+      const auto next = next_task ();
+      const TaskPtr task = *next;
+      S.queue.erase (next);
+      S.queued.erase ({task->dir, task->name});
+      S.running.push_back (task);
+      Device &device = S.devices[task->dev];
+      if (device.running++ == 0)
+        device.active_since = Clock::now ();
+      lock.unlock ();
+
+      Result result {task->dir, task->name, task->scan_id, 0, 0, 0,
+                     std::make_unique<Summary> (), ScanStatus::Complete, {}};
+      bool done = true;
+      ScanHooks hooks;
+      if (Options::find_duplicates)
+        hooks.file = Duplicates::record;
+      hooks.follow = task->visited.get ();
+      hooks.extents = task->extents.get ();
+      if (Options::estimate)
+        done = refine_estimate (*task, result);
+      else
+        result.status = directory_size_and_file_count (task->dir / task->name,
+                                                       result.size,
+                                                       result.file_count,
+                                                       *result.summary,
+                                                       result.errors,
+                                                       task->limits,
+                                                       &task->progress,
+                                                       &hooks);
+
+      lock.lock ();
+      std::erase (S.running, task);
+      device.entries += task->progress.entries;
+      if (--device.running == 0)
+        device.busy += Clock::now () - device.active_since;
+      // Another task for the same device may be able to run now
+      if (Options::device_threads)
+        S.queued_cv.notify_all ();
+      if (!done && !task->discard)
+        {
+          const auto it = S.queue.insert (S.queue.end (), task);
+          S.queued.emplace (std::make_pair (task->dir, task->name), it);
+          continue;
+        }
+      if (!task->discard)
+        {
+          S.entries[task->dir] += task->progress.entries;
+          S.finished.push_back (std::move (result));
+        }
+      S.finished_cv.notify_all ();
+    }
+}
+
+// Starts workers until there are enough to give every device its full
+// budget.
+static void
+start_workers ()
+{
+  unsigned n = (Options::scan_threads
+                ? Options::scan_threads
+                : std::max (1U, std::thread::hardware_concurrency ()));
+  if (Options::device_threads)
+    n = std::max<unsigned> (n, Options::device_threads * S.devices.size ());
+  for (; S.workers < n; ++S.workers)
+    std::thread (worker).detach ();
+}
+
+void
+enqueue (const fs::path &dir, const fs::path &name, u64 scan_id,
+         dev_t dev, const ScanLimits &limits,
+         std::shared_ptr<VisitedDirs> visited,
+         std::shared_ptr<ExtentMap> extents)
+{
+  std::lock_guard lock (S.mutex);
+  S.devices.try_emplace (dev);
+  start_workers ();
+  const auto it = S.queue.insert (
+    S.queue.end (),
+    std::make_shared<Task> (dir, name, scan_id, dev, limits,
+                           std::move (visited), std::move (extents))
+  );
+  S.queued.emplace (std::make_pair (dir, name), it);
+  S.queued_cv.notify_one ();
+}
+
+void
+prioritize (const fs::path &dir, const fs::path &name)
+{
+  std::lock_guard lock (S.mutex);
+  const auto it = S.queued.find ({dir, name});
+  if (it != S.queued.end ())
+    S.queue.splice (S.queue.begin (), S.queue, it->second);
+}
+
+void
+prioritize (const fs::path &dir)
+{
+  std::lock_guard lock (S.mutex);
+  Queue front;
+  for (auto it = S.queue.begin (); it != S.queue.end ();)
+    {
+      const auto next = std::next (it);
+      if ((*it)->dir == dir)
+        front.splice (front.end (), S.queue, it);
+      it = next;
+    }
+  S.queue.splice (S.queue.begin (), front);
+}
+
+void
+drop (const fs::path &dir)
+{
+  std::lock_guard lock (S.mutex);
+  for (auto it = S.queued.lower_bound ({dir, {}});
+       it != S.queued.end () && it->first.first == dir;)
+    {
+      S.queue.erase (it->second);
+      it = S.queued.erase (it);
+    }
+  for (const TaskPtr &task : S.running)
+    if (task->dir == dir)
+      {
+        task->discard = true;
+        task->progress.cancel = true;
+      }
+  std::erase_if (S.finished, [&dir](const Result &r) { return r.dir == dir; });
+  S.entries.erase (dir);
+}
+
+void
+cancel ()
+{
+  std::lock_guard lock (S.mutex);
+  // Estimates waiting for their next slice are kept as they are
+  for (const TaskPtr &task : S.queue)
+    if (task->estimator)
+      {
+        Result result {task->dir, task->name, task->scan_id, 0, 0, 0,
+                       std::make_unique<Summary> (), ScanStatus::Estimated,
+                       {}};
+        publish_estimate (*task, result);
+        S.finished.push_back (std::move (result));
+      }
+  S.queue.clear ();
+  S.queued.clear ();
+  for (const TaskPtr &task : S.running)
+    task->progress.cancel = true;
+}
+
+bool
+busy (const fs::path &dir)
+{
+  std::lock_guard lock (S.mutex);
+  const auto it = S.queued.lower_bound ({dir, {}});
+  return ((it != S.queued.end () && it->first.first == dir)
+          || std::any_of (S.running.begin (), S.running.end (),
+                          [&dir](const TaskPtr &t) { return t->dir == dir; }));
+}
+
+bool
+busy ()
+{
+  std::lock_guard lock (S.mutex);
+  return !S.queue.empty () || !S.running.empty () || !S.finished.empty ();
+}
+
+std::vector<Progress>
+running ()
+{
+  std::vector<Progress> result;
+  std::lock_guard lock (S.mutex);
+  for (const TaskPtr &task : S.running)
+    result.emplace_back (task->dir, task->name, task->scan_id,
+                         task->progress.size, task->progress.file_count,
+                         task->progress.margin);
+  return result;
+}
+
+u64
+entries (const fs::path &dir)
+{
+  std::lock_guard lock (S.mutex);
+  const auto it = S.entries.find (dir);
+  u64 result = it == S.entries.end () ? 0 : it->second;
+  for (const TaskPtr &task : S.running)
+    if (task->dir == dir)
+      result += task->progress.entries;
+  return result;
+}
+
+std::vector<DeviceStats>
+devices ()
+{
+  std::lock_guard lock (S.mutex);
+  const Clock::time_point now = Clock::now ();
+  std::vector<DeviceStats> result;
+  for (const auto &[dev, device] : S.devices)
+    {
+      if (device.running == 0)
+        continue;
+      u64 entries = device.entries;
+      for (const TaskPtr &task : S.running)
+        if (task->dev == dev)
+          entries += task->progress.entries;
+      const f64 seconds = std::chrono::duration<f64> (
+        device.busy + (now - device.active_since)
+      ).count ();
+      result.emplace_back (dev, device.running,
+                           seconds > 0.0 ? entries / seconds : 0.0);
+    }
+  return result;
+}
+
+std::vector<Result>
+finished ()
+{
+  std::lock_guard lock (S.mutex);
+  return std::exchange (S.finished, {});
+}
+
+void
+wait ()
+{
+  std::unique_lock lock (S.mutex);
+  S.finished_cv.wait (lock, []() {
+    return S.queue.empty () && S.running.empty ();
+  });
+}
+}
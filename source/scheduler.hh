@@ -0,0 +1,96 @@
+#pragma once
+#include "stdafx.hh"
+#include "summary.hh"
+#include "space_info.hh"
+#include "extents.hh"
+
+// Sizes subdirectories on a pool of worker threads.  Tasks are processed in
+// the order they were queued in, unless they get moved to the front with
+// `prioritize'.  When estimating sizes a task only runs for a short slice at
+// a time and then goes to the back of the queue until its estimate is good
+// enough.
+namespace Scheduler
+{
+// A finished task
+struct Result
+{
+  fs::path dir;
+  fs::path name;
+  u64 scan_id;
+  u64 size;
+  u64 file_count;
+  // Half width of the confidence interval if the values are estimated
+  u64 margin;
+  std::unique_ptr<Summary> summary;
+  ScanStatus status;
+  ScanErrors errors;
+};
+
+// State of a running task
+struct Progress
+{
+  fs::path dir;
+  fs::path name;
+  u64 scan_id;
+  u64 size;
+  u64 file_count;
+  u64 margin;
+};
+
+// Throughput of a device that has running tasks
+struct DeviceStats
+{
+  dev_t dev;
+  unsigned running;
+  // Directory entries looked at per second while the device had running
+  // tasks
+  f64 rate;
+};
+
+// Queues sizing the subdirectory `name' of `dir', which is on the device
+// `dev'.  The scan id is passed through to the result.  With a per-device
+// budget only that many tasks run on each device at the same time and the
+// pool grows so every device can use its full budget.  If `visited' is given
+// the task follows symlinks to directories and with `extents' it checks the
+// extents of big files, sharing them with the other tasks of the scan.
+void enqueue (const fs::path &dir, const fs::path &name, u64 scan_id,
+              dev_t dev, const ScanLimits &limits,
+              std::shared_ptr<VisitedDirs> visited = nullptr,
+              std::shared_ptr<ExtentMap> extents = nullptr);
+
+// Moves the task for the given subdirectory to the front of the queue.
+void prioritize (const fs::path &dir, const fs::path &name);
+
+// Moves all tasks for subdirectories of `dir' to the front of the queue,
+// keeping their order.
+void prioritize (const fs::path &dir);
+
+// Removes all queued tasks for subdirectories of `dir' and cancels the
+// running ones.
+void drop (const fs::path &dir);
+
+// Stops all running tasks, their results are reported as truncated, and
+// removes all queued tasks.
+void cancel ();
+
+// Returns whether there are any queued, running or unclaimed finished tasks.
+bool busy ();
+
+// Returns whether there are queued or running tasks for subdirectories of
+// `dir'.
+bool busy (const fs::path &dir);
+
+std::vector<Progress> running ();
+
+// Returns the number of directory entries the tasks for subdirectories of
+// `dir' have looked at so far.
+u64 entries (const fs::path &dir);
+
+std::vector<DeviceStats> devices ();
+
+// Returns the results of all tasks finished since the last call.
+std::vector<Result> finished ();
+
+// Blocks until all queued tasks are finished.
+void wait ();
+}
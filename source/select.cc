@@ -24,13 +24,9 @@ select (std::string_view word, const SpaceInfo &si)
   clear_selection ();
   if (word.empty ())
     return;
-  usize i = 0;
-  for (const auto &item : si)
-    {
-      if (item.path.native ().starts_with (word))
-        S_selection.push_back (i);
-      ++i;
-    }
+  for (usize i = 0; i <= si.item_count (); ++i)
+    if (si[i].path.native ().starts_with (word))
+      S_selection.push_back (i);
   S_last_word = word;
 }
 
@@ -0,0 +1,607 @@
+#include "snapshot.hh"
+#include "encoding.hh"
+#include "mounts.hh"
+#include <fcntl.h>
+#include <unistd.h>
+#include <random>
+
+namespace Snapshot
+{
+static constexpr std::string_view MAGIC = "SISNAP1\n";
+
+// The file ends with the offset of the index as a little endian u64
+static constexpr usize TRAILER_SIZE = 8;
+
+// Longest chain of snapshots written against each other that gets followed
+static constexpr unsigned MAX_BASES = 64;
+
+enum PageKind : u8
+{
+  FULL,
+  // Changes to the listing in the base
+  DELTA,
+  // The directory is in the base but no longer exists
+  REMOVED
+};
+
+enum ChangeKind : u8
+{
+  CHANGE_REMOVED,
+  // Also used for an entry that turned from a file into a directory or back
+  CHANGE_ADDED,
+  CHANGE_MODIFIED
+};
+
+enum EntryFlags : u8
+{
+  DIRECTORY = 1
+};
+
+struct Page
+{
+  PageKind kind;
+  u64 offset;
+  u64 size;
+};
+
+struct Index
+{
+  u64 id;
+  time_t time;
+  fs::path root;
+  // Free space of the file system at the time of the scan
+  u64 free;
+  // Resolved path of the base and its id, empty for full snapshots
+  fs::path base;
+  u64 base_id;
+  // By path relative to the root, which is the empty string
+  std::map<std::string, Page, std::less<>> pages;
+};
+
+// Snapshots are never modified, so their indexes are kept once read
+static std::map<fs::path, Index> S_indexes;
+
+static void
+set_error (int error)
+{
+  G_error = std::error_code (error, std::system_category ());
+}
+
+static bool
+read_at (int fd, std::string &data, u64 offset, usize size)
+{
+  data.resize (size);
+  for (usize done = 0; done < size;)
+    {
+      const ssize_t n = ::pread (fd, data.data () + done, size - done,
+                                 offset + done);
+      if (n == -1 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        {
+          set_error (n == 0 ? EBADMSG : errno);
+          return false;
+        }
+      done += n;
+    }
+  return true;
+}
+
+static void
+encode_name (Encoder &enc, std::string_view previous, std::string_view name)
+{
+  const usize shared = std::mismatch (previous.begin (), previous.end (),
+                                      name.begin (), name.end ()).first
+                       - previous.begin ();
+  enc.uint (shared);
+  enc.string (name.substr (shared));
+}
+
+// Replaces the end of `name' as stored by `encode_name'.
+static bool
+decode_name (Decoder &dec, std::string &name)
+{
+  const u64 shared = dec.uint ();
+  const std::string_view suffix = dec.string ();
+  if (shared > name.size ())
+    return false;
+  name.resize (shared);
+  name += suffix;
+  return dec.ok ();
+}
+
+static void
+encode_fields (Encoder &enc, const Entry &entry)
+{
+  enc.uint (entry.is_directory ? DIRECTORY : 0);
+  enc.uint (entry.size);
+  if (entry.is_directory)
+    enc.uint (entry.file_count);
+}
+
+static void
+decode_fields (Decoder &dec, Entry &entry)
+{
+  entry.is_directory = dec.uint () & DIRECTORY;
+  entry.size = dec.uint ();
+  entry.file_count = entry.is_directory ? dec.uint () : 1;
+}
+
+static void
+encode_page (Encoder &enc, const std::vector<Entry> &entries)
+{
+  enc.uint (entries.size ());
+  std::string_view previous;
+  time_t mtime = 0;
+  for (const Entry &entry : entries)
+    {
+      encode_name (enc, previous, entry.name);
+      encode_fields (enc, entry);
+      enc.sint (entry.mtime - mtime);
+      previous = entry.name;
+      mtime = entry.mtime;
+    }
+}
+
+static bool
+decode_page (std::string_view data, std::vector<Entry> &entries)
+{
+  Decoder dec (data);
+  std::string name;
+  time_t mtime = 0;
+  entries.clear ();
+  for (u64 n = dec.uint (); n && dec.ok (); --n)
+    {
+      if (!decode_name (dec, name))
+        return false;
+      Entry &entry = entries.emplace_back (name);
+      decode_fields (dec, entry);
+      entry.mtime = mtime += dec.sint ();
+    }
+  return dec.ok () && dec.at_end ();
+}
+
+// Encodes the changes from `base' to `entries', both sorted by name.
+// Returns false if there are none.
+static bool
+encode_delta (Encoder &enc, const std::vector<Entry> &base,
+              const std::vector<Entry> &entries)
+{
+  Encoder changes;
+  u64 count = 0;
+  std::string_view previous;
+  const auto change = [&](const Entry &entry, ChangeKind kind) {
+    encode_name (changes, previous, entry.name);
+    changes.uint (kind);
+    previous = entry.name;
+    ++count;
+  };
+  auto old = base.begin ();
+  for (auto now = entries.begin (); old != base.end () || now != entries.end ();)
+    if (now == entries.end ()
+        || (old != base.end () && old->name < now->name))
+      change (*old++, CHANGE_REMOVED);
+    else if (old == base.end () || now->name < old->name
+             || now->is_directory != old->is_directory)
+      {
+        if (old != base.end () && old->name == now->name)
+          ++old;
+        change (*now, CHANGE_ADDED);
+        encode_fields (changes, *now);
+        changes.sint (now->mtime);
+        ++now;
+      }
+    else
+      {
+        if (now->size != old->size || now->file_count != old->file_count
+            || now->mtime != old->mtime)
+          {
+            change (*now, CHANGE_MODIFIED);
+            changes.sint (static_cast<s64> (now->size - old->size));
+            changes.sint (static_cast<s64> (now->file_count - old->file_count));
+            changes.sint (now->mtime - old->mtime);
+          }
+        ++old;
+        ++now;
+      }
+  if (count == 0)
+    return false;
+  enc.uint (count);
+  enc.raw (changes.data ());
+  return true;
+}
+
+// Applies the changes stored by `encode_delta' to the listing in `entries'.
+static bool
+apply_delta (std::string_view data, std::vector<Entry> &entries)
+{
+  Decoder dec (data);
+  std::vector<Entry> result;
+  result.reserve (entries.size ());
+  auto old = entries.begin ();
+  std::string name;
+  for (u64 n = dec.uint (); n && dec.ok (); --n)
+    {
+      if (!decode_name (dec, name))
+        return false;
+      for (; old != entries.end () && old->name < name; ++old)
+        result.push_back (std::move (*old));
+      const bool exists = old != entries.end () && old->name == name;
+      switch (dec.uint ())
+        {
+          break; case CHANGE_REMOVED:
+            old += exists;
+          break; case CHANGE_ADDED:
+            {
+              old += exists;
+              Entry &entry = result.emplace_back (name);
+              decode_fields (dec, entry);
+              entry.mtime = dec.sint ();
+            }
+          break; case CHANGE_MODIFIED:
+            {
+              if (!exists)
+                return false;
+              Entry &entry = result.emplace_back (std::move (*old++));
+              entry.size += dec.sint ();
+              entry.file_count += dec.sint ();
+              entry.mtime += dec.sint ();
+            }
+          break; default:
+            return false;
+        }
+    }
+  std::move (old, entries.end (), std::back_inserter (result));
+  entries = std::move (result);
+  return dec.ok () && dec.at_end ();
+}
+
+static const Index *
+open_index (const fs::path &file)
+{
+  if (const auto it = S_indexes.find (file); it != S_indexes.end ())
+    return &it->second;
+  G_error.clear ();
+  const int fd = ::open (file.c_str (), O_RDONLY | O_CLOEXEC);
+  struct stat sb;
+  if (fd == -1 || ::fstat (fd, &sb) == -1)
+    {
+      set_error (errno);
+      if (fd != -1)
+        ::close (fd);
+      return nullptr;
+    }
+  const u64 file_size = sb.st_size;
+  std::string magic, trailer, data;
+  bool ok = (file_size >= MAGIC.size () + TRAILER_SIZE
+             && read_at (fd, magic, 0, MAGIC.size ()) && magic == MAGIC
+             && read_at (fd, trailer, file_size - TRAILER_SIZE,
+                         TRAILER_SIZE));
+  u64 index_offset = 0;
+  if (ok)
+    {
+      for (usize i = TRAILER_SIZE; i-- > 0;)
+        index_offset = index_offset << 8 | static_cast<u8> (trailer[i]);
+      ok = (index_offset >= MAGIC.size ()
+            && index_offset <= file_size - TRAILER_SIZE
+            && read_at (fd, data, index_offset,
+                        file_size - TRAILER_SIZE - index_offset));
+    }
+  ::close (fd);
+
+  Index index;
+  Decoder dec (data);
+  if (ok)
+    {
+      index.id = dec.uint ();
+      index.time = dec.sint ();
+      index.root = dec.string ();
+      index.free = dec.uint ();
+      index.base = dec.string ();
+      index.base_id = dec.uint ();
+      if (index.base.is_relative () && !index.base.empty ())
+        index.base = file.parent_path () / index.base;
+      std::string path;
+      u64 offset = MAGIC.size ();
+      for (u64 n = dec.uint (); n && ok && dec.ok (); --n)
+        {
+          ok = decode_name (dec, path);
+          const u64 kind = dec.uint ();
+          const u64 size = dec.uint ();
+          ok = ok && kind <= REMOVED && size <= index_offset - offset;
+          index.pages.insert_or_assign (
+            path, Page {static_cast<PageKind> (kind), offset, size}
+          );
+          offset += size;
+        }
+      ok = ok && dec.ok () && dec.at_end ();
+    }
+  if (!ok)
+    {
+      if (!G_error)
+        set_error (EBADMSG);
+      return nullptr;
+    }
+  return &S_indexes.emplace (file, std::move (index)).first->second;
+}
+
+// Returns the path of the directory relative to the root of the snapshot,
+// or nullopt if it is not below it.
+static std::optional<std::string>
+relative_path (const Index &index, const fs::path &path)
+{
+  const fs::path rel = path.lexically_relative (index.root);
+  if (rel.empty () || *rel.begin () == "..")
+    return std::nullopt;
+  return rel == "." ? std::string () : rel.native ();
+}
+
+// Returns the index of the base of the snapshot if it is the one the
+// snapshot was written against.
+static const Index *
+open_base (const Index &index)
+{
+  const Index *const base = open_index (index.base);
+  if (base && base->id != index.base_id)
+    {
+      set_error (ESTALE);
+      return nullptr;
+    }
+  return base;
+}
+
+static bool
+read_listing (const fs::path &file, const Index &index, const std::string &dir,
+              std::vector<Entry> &entries, unsigned depth = 0)
+{
+  if (depth > MAX_BASES)
+    {
+      set_error (ELOOP);
+      return false;
+    }
+  const auto it = index.pages.find (dir);
+  if ((it == index.pages.end () && index.base.empty ())
+      || (it != index.pages.end () && it->second.kind == REMOVED))
+    {
+      set_error (ENOENT);
+      return false;
+    }
+  const Index *base = nullptr;
+  if ((it == index.pages.end () || it->second.kind == DELTA)
+      && (!(base = open_base (index))
+          || !read_listing (index.base, *base, dir, entries, depth + 1)))
+    return false;
+  if (it == index.pages.end ())
+    return true;
+  const int fd = ::open (file.c_str (), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    {
+      set_error (errno);
+      return false;
+    }
+  std::string data;
+  const bool ok = read_at (fd, data, it->second.offset, it->second.size);
+  ::close (fd);
+  if (!ok)
+    return false;
+  if (!(it->second.kind == FULL ? decode_page (data, entries)
+        : apply_delta (data, entries)))
+    {
+      set_error (EBADMSG);
+      return false;
+    }
+  return true;
+}
+
+// Adds the paths of all directories in the snapshot to `dirs'.
+static bool
+collect_dirs (const Index &index, std::set<std::string> &dirs,
+              unsigned depth = 0)
+{
+  if (!index.base.empty ())
+    {
+      const Index *const base = open_base (index);
+      if (!base || depth > MAX_BASES || !collect_dirs (*base, dirs, depth + 1))
+        return false;
+    }
+  for (const auto &[dir, page] : index.pages)
+    if (page.kind == REMOVED)
+      dirs.erase (dir);
+    else
+      dirs.insert (dir);
+  return true;
+}
+
+static std::vector<Entry>
+listing (const Scan::Node &node)
+{
+  std::vector<Entry> entries;
+  entries.reserve (node.children.size () + node.files.size ());
+  for (const Scan::Node &child : node.children)
+    entries.emplace_back (child.name.native (), true, child.size,
+                          child.file_count, 0);
+  for (const Scan::File &file : node.files)
+    entries.emplace_back (file.name, false, file.size, 1, file.mtime);
+  std::sort (entries.begin (), entries.end (),
+             [](const Entry &a, const Entry &b) { return a.name < b.name; });
+  return entries;
+}
+
+static void
+collect_nodes (const Scan::Node &node, const std::string &path,
+               std::vector<std::pair<std::string, const Scan::Node *>> &nodes)
+{
+  nodes.emplace_back (path, &node);
+  for (const Scan::Node &child : node.children)
+    collect_nodes (child,
+                   path.empty () ? child.name.native ()
+                   : path + '/' + child.name.native (),
+                   nodes);
+}
+
+// Writes the data to a temporary file next to `file' and renames it.
+static bool
+write_file (const fs::path &file, std::string_view data)
+{
+  const std::string temp = (file.native () + ".tmp."
+                            + std::to_string (::getpid ()));
+  FILE *const f = std::fopen (temp.c_str (), "w");
+  if (f == nullptr)
+    {
+      set_error (errno);
+      return false;
+    }
+  const bool written = std::fwrite (data.data (), 1, data.size (), f)
+                       == data.size ();
+  if (std::fclose (f) != 0 || !written
+      || std::rename (temp.c_str (), file.c_str ()) != 0)
+    {
+      set_error (errno);
+      std::remove (temp.c_str ());
+      return false;
+    }
+  return true;
+}
+
+bool
+write (const fs::path &file, const Scan::Handle &scan, const fs::path &base)
+{
+  const Index *const base_index = base.empty () ? nullptr : open_index (base);
+  if (!base.empty () && !base_index)
+    return false;
+
+  std::vector<std::pair<std::string, const Scan::Node *>> nodes;
+  collect_nodes (scan.root (), "", nodes);
+  std::sort (nodes.begin (), nodes.end ());
+
+  std::string data (MAGIC);
+  Encoder index;
+  u64 page_count = 0;
+  std::string_view previous;
+  const auto add_page = [&](std::string_view dir, PageKind kind,
+                            const Encoder &page) {
+    encode_name (index, previous, dir);
+    index.uint (kind);
+    index.uint (page.size ());
+    data += page.data ();
+    previous = dir;
+    ++page_count;
+  };
+  std::set<std::string> removed;
+  if (base_index && !collect_dirs (*base_index, removed))
+    return false;
+  Encoder page;
+  std::vector<Entry> old;
+  for (const auto &[dir, node] : nodes)
+    {
+      const std::vector<Entry> entries = listing (*node);
+      page.clear ();
+      removed.erase (dir);
+      PageKind kind = FULL;
+      if (!base_index)
+        encode_page (page, entries);
+      else if (read_listing (base, *base_index, dir, old))
+        {
+          if (!encode_delta (page, old, entries))
+            continue;
+          kind = DELTA;
+        }
+      else if (G_error == std::errc::no_such_file_or_directory)
+        encode_page (page, entries);
+      else
+        return false;
+      add_page (dir, kind, page);
+    }
+  page.clear ();
+  for (const std::string &dir : removed)
+    add_page (dir, REMOVED, page);
+
+  // The base is found relative to the snapshot so both can be moved together
+  fs::path base_path;
+  if (base_index)
+    {
+      base_path = fs::absolute (base).lexically_relative (
+        fs::absolute (file).parent_path ()
+      );
+      if (base_path.empty ())
+        base_path = fs::absolute (base);
+    }
+  const u64 index_offset = data.size ();
+  Encoder header;
+  header.uint (std::random_device () () | u64 {std::random_device () ()} << 32);
+  header.sint (std::time (nullptr));
+  header.string (scan.root ().name.native ());
+  header.uint (Mounts::free_space (scan.root ().name));
+  header.string (base_path.native ());
+  header.uint (base_index ? base_index->id : 0);
+  header.uint (page_count);
+  data += header.data ();
+  data += index.data ();
+  for (usize i = 0; i < TRAILER_SIZE; ++i)
+    data += static_cast<char> (index_offset >> (i * 8));
+  return write_file (file, data);
+}
+
+fs::path
+root (const fs::path &file)
+{
+  const Index *const index = open_index (file);
+  return index ? index->root : fs::path {};
+}
+
+bool
+contains (const fs::path &file, const fs::path &path)
+{
+  const Index *index = open_index (file);
+  const std::optional<std::string> dir = (index ? relative_path (*index, path)
+                                          : std::nullopt);
+  for (unsigned depth = 0; index && dir && depth <= MAX_BASES; ++depth)
+    {
+      if (const auto it = index->pages.find (*dir); it != index->pages.end ())
+        return it->second.kind != REMOVED;
+      index = index->base.empty () ? nullptr : open_base (*index);
+    }
+  return false;
+}
+
+bool
+read (const fs::path &file, const fs::path &path, std::vector<Entry> &entries)
+{
+  const Index *const index = open_index (file);
+  if (!index)
+    return false;
+  const std::optional<std::string> dir = relative_path (*index, path);
+  if (!dir)
+    {
+      set_error (ENOENT);
+      return false;
+    }
+  return read_listing (file, *index, *dir, entries);
+}
+
+SpaceInfo *
+load (const fs::path &file, const fs::path &path)
+{
+  if (G_dirs.contains (path))
+    return &G_dirs[path];
+  std::vector<Entry> entries;
+  if (!read (file, path, entries))
+    return nullptr;
+  SpaceInfo si;
+  si.add_parent (path.parent_path ());
+  for (const Entry &entry : entries)
+    {
+      struct stat sb {};
+      sb.st_mode = entry.is_directory ? S_IFDIR : S_IFREG;
+      sb.st_size = entry.size;
+      sb.st_mtime = sb.st_atime = entry.mtime;
+      if (entry.is_directory)
+        si.add (path / entry.name, entry.size, entry.file_count, true,
+                nullptr, nullptr, &sb);
+      else
+        si.add_file (path / entry.name, sb);
+    }
+  file_system_free = open_index (file)->free;
+  return &G_dirs.insert_or_assign (path, std::move (si)).first->second;
+}
+}
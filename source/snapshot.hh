@@ -0,0 +1,50 @@
+#pragma once
+#include "stdafx.hh"
+#include "scan.hh"
+#include "space_info.hh"
+
+// Compact storage of scan results for keeping them around for a long time.
+//
+// A snapshot has one page per directory with its entries sorted by name.
+// Each name is stored as the length of the prefix it shares with the
+// previous name plus the rest, and the numbers are varints.  The index at
+// the end of the file maps the paths of the directories, front coded the
+// same way, to their pages, so a single listing can be read without
+// decoding the others.
+//
+// A snapshot written against a base only has pages for the directories that
+// changed, and they only hold the entries that were added, removed or
+// changed.  Directories missing from it are read from the base.
+namespace Snapshot
+{
+struct Entry
+{
+  std::string name;
+  bool is_directory;
+  u64 size;
+  u64 file_count;
+  time_t mtime;
+};
+
+// Writes the tree of the finished scan to `file'.  If `base' is given only
+// the differences to that snapshot are written.  Returns false and sets
+// `G_error' on error.
+bool write (const fs::path &file, const Scan::Handle &scan,
+            const fs::path &base = {});
+
+// Returns the path of the directory the snapshot was taken of, or an empty
+// path and sets `G_error' if the file cannot be read.
+fs::path root (const fs::path &file);
+
+// Returns whether the snapshot has a listing for the directory at `path'.
+bool contains (const fs::path &file, const fs::path &path);
+
+// Reads the listing of the directory at `path' from the snapshot, sorted
+// by name.  Returns false and sets `G_error' on error.
+bool read (const fs::path &file, const fs::path &path,
+           std::vector<Entry> &entries);
+
+// Reads the listing of the directory at `path' and caches it in `G_dirs'.
+// Returns nullptr and sets `G_error' on error.
+SpaceInfo * load (const fs::path &file, const fs::path &path);
+}
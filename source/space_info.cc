@@ -1,4 +1,11 @@
 #include "space_info.hh"
+#include "options.hh"
+#include "duplicates.hh"
+#include "scheduler.hh"
+#include "throttle.hh"
+#include "mounts.hh"
+#include "extents.hh"
+#include <fcntl.h>
 
 std::error_code G_error;
 
@@ -12,44 +19,347 @@ SpaceInfo::add_parent (const fs::path &parent)
 
 void
 SpaceInfo::add (const fs::path &full_path, u64 size, u64 file_count,
-                bool is_directory, const char *error)
+                bool is_directory, const char *error,
+                std::unique_ptr<Summary> summary, const struct stat *sb)
 {
-  const fs::path path = full_path.filename ();
+  fs::path path = full_path.filename ();
   file_count_ += file_count;
-  insert_sorted (Item { path, size, is_directory, error });
+  if (summary)
+    summary_.merge (*summary);
+  insert (Item { std::move (path), size, is_directory, error, nullptr,
+                        std::move (summary),
+                        sb ? sb->st_mtime : 0, sb ? sb->st_atime : 0,
+                        file_count, sb ? sb->st_uid : 0, sb ? sb->st_gid : 0 });
   total_ += size;
   if (size > biggest_)
     biggest_ = size;
 }
 
 void
-SpaceInfo::sort (bool ascending)
+SpaceInfo::add_file (const fs::path &full_path, const struct stat &sb)
 {
-  auto comp = [ascending] (const Item &a, const Item &b) {
-    return (a.size == b.size
-            ? a.path < b.path
-            : (a.size > b.size) ^ ascending);
-  };
-  std::sort (items_.begin () + 1, items_.end (), comp);
+  summary_.add_file (full_path.filename ().native (), sb);
+  add (full_path, sb.st_size, 1, false, nullptr, nullptr, &sb);
 }
 
 void
-SpaceInfo::insert_sorted (Item &&item)
+SpaceInfo::add_pending (const fs::path &full_path, const struct stat &sb)
 {
-  if (items_.size () == 1)
+  insert (Item { full_path.filename (), 0, true, nullptr, nullptr,
+                        nullptr, sb.st_mtime, sb.st_atime, 0, sb.st_uid,
+                        sb.st_gid, true });
+  ++partial_;
+}
+
+bool
+SpaceInfo::set (const fs::path &name, u64 size, u64 file_count, bool partial,
+                std::unique_ptr<Summary> summary, const char *error)
+{
+  const auto it = find (name);
+  if (it == items_.end ())
+    return false;
+  if (it->partial != partial)
     {
-      items_.push_back (item);
-      return;
+      if (partial)
+        ++partial_;
+      else
+        --partial_;
+      it->partial = partial;
+    }
+  if (summary)
+    {
+      if (it->summary)
+        summary_.subtract (*it->summary);
+      summary_.merge (*summary);
+      it->summary = std::move (summary);
+    }
+  if (error)
+    it->error = error;
+  return update (it, static_cast<s64> (size - it->size),
+                 static_cast<s64> (file_count - it->file_count), nullptr,
+                 nullptr);
+}
+
+void
+SpaceInfo::set_unreadable (const fs::path &name, u64 count, int error)
+{
+  const auto it = find (name);
+  if (it == items_.end ())
+    return;
+  unreadable_ = unreadable_ - it->unreadable + count;
+  it->unreadable = count;
+  it->read_error = error;
+  if (count && !read_error_)
+    read_error_ = error;
+}
+
+void
+SpaceInfo::set_margin (const fs::path &name, u64 margin)
+{
+  const auto it = find (name);
+  if (it != items_.end ())
+    it->margin = margin;
+}
+
+u64
+SpaceInfo::total_margin () const
+{
+  f64 variance = 0.0;
+  for (usize i = 1; i < items_.size (); ++i)
+    variance += static_cast<f64> (items_[i].margin) * items_[i].margin;
+  return static_cast<u64> (std::sqrt (variance));
+}
+
+usize
+SpaceInfo::index_of (const fs::path &name) const
+{
+  const auto found = index_.find (name.native ());
+  if (found == index_.end ())
+    return 0;
+  const u32 idx = found->second;
+  // The item is where a binary search puts it unless the order went stale,
+  // like a cold order as time passes.
+  const std::vector<u32> &order = this->order ();
+  auto it = std::lower_bound (order.begin (), order.end (), idx,
+                              [this](u32 a, u32 b) {
+                                return comes_before (key_, a, b);
+                              });
+  if (it == order.end () || *it != idx)
+    it = std::find (order.begin (), order.end (), idx);
+  const usize pos = it - order.begin ();
+  return reversed_ ? order.size () - pos : pos + 1;
+}
+
+u64
+SpaceInfo::cold_bytes (const Item &item, u32 days) const
+{
+  if (item.summary)
+    return item.summary->idle.bytes_older_than (days);
+  if (item.is_directory || item.error)
+    return 0;
+  const u32 idle = std::min (Age::days_since (item.mtime),
+                             Age::days_since (item.atime));
+  return idle >= days ? item.size : 0;
+}
+
+Summary
+SpaceInfo::summary_of (usize idx) const
+{
+  return idx == 0 ? summary_ : item_summary ((*this)[idx]);
+}
+
+Summary
+SpaceInfo::item_summary (const Item &item)
+{
+  if (item.summary)
+    return *item.summary;
+  Summary summary;
+  if (!item.is_directory && !item.error)
+    {
+      struct stat sb {};
+      sb.st_mode = S_IFREG;
+      sb.st_size = item.size;
+      sb.st_mtime = item.mtime;
+      sb.st_atime = item.atime;
+      sb.st_uid = item.uid;
+      sb.st_gid = item.gid;
+      summary.add_file (item.path.native (), sb);
+    }
+  return summary;
+}
+
+bool
+SpaceInfo::comes_before (SortKey key, u32 a, u32 b) const
+{
+  const Item &x = items_[a];
+  const Item &y = items_[b];
+  // Comparing the native strings is a lot cheaper than comparing paths
+  // component by component.
+  const auto by_name = [&]() { return x.path.native () < y.path.native (); };
+  switch (key)
+    {
+      break; case SortKey::Size:
+        {
+          const u64 x_size = cold_days_ ? cold_bytes (x, cold_days_) : x.size;
+          const u64 y_size = cold_days_ ? cold_bytes (y, cold_days_) : y.size;
+          return x_size == y_size ? by_name () : x_size > y_size;
+        }
+      break; case SortKey::FileCount:
+        return (x.file_count == y.file_count
+                ? by_name () : x.file_count > y.file_count);
+      break; case SortKey::Modified:
+        return x.mtime == y.mtime ? by_name () : x.mtime > y.mtime;
+      break; default:
+        return by_name ();
+    }
+}
+
+const std::vector<u32> &
+SpaceInfo::order () const
+{
+  const usize key = static_cast<usize> (key_);
+  std::vector<u32> &order = orders_[key];
+  if (valid_orders_ & (1U << key))
+    return order;
+  order.resize (items_.size () - 1);
+  std::iota (order.begin (), order.end (), 1U);
+  std::sort (order.begin (), order.end (), [this](u32 a, u32 b) {
+    return comes_before (key_, a, b);
+  });
+  valid_orders_ |= 1U << key;
+  return order;
+}
+
+void
+SpaceInfo::sort (SortKey key, bool reversed, u32 cold_days)
+{
+  key_ = key;
+  reversed_ = reversed;
+  if (cold_days != cold_days_)
+    {
+      cold_days_ = cold_days;
+      valid_orders_ &= ~(1U << static_cast<usize> (SortKey::Size));
+    }
+}
+
+SpaceInfo::iterator
+SpaceInfo::find (const fs::path &name)
+{
+  const auto found = index_.find (name.native ());
+  return found == index_.end () ? items_.end ()
+                                : items_.begin () + found->second;
+}
+
+void
+SpaceInfo::reposition (u32 idx)
+{
+  for (const SortKey key : {SortKey::Size, SortKey::FileCount,
+                            SortKey::Modified})
+    {
+      const usize k = static_cast<usize> (key);
+      if (!(valid_orders_ & (1U << k)))
+        continue;
+      std::vector<u32> &order = orders_[k];
+      const auto it = std::find (order.begin (), order.end (), idx);
+      const auto before = [this, key](u32 a, u32 b) {
+        return comes_before (key, a, b);
+      };
+      const auto up = std::upper_bound (order.begin (), it, idx, before);
+      if (up != it)
+        std::rotate (up, it, it + 1);
+      else
+        std::rotate (it, it + 1, std::lower_bound (it + 1, order.end (), idx,
+                                                   before));
+    }
+}
+
+void
+SpaceInfo::update_biggest ()
+{
+  biggest_ = 0;
+  for (auto it = items_.begin () + 1; it != items_.end (); ++it)
+    biggest_ = std::max<u64> (biggest_, it->size);
+}
+
+bool
+SpaceInfo::update (const fs::path &name, s64 size, s64 file_count,
+                   const Summary *removed, const Summary *added)
+{
+  return update (find (name), size, file_count, removed, added);
+}
+
+bool
+SpaceInfo::update (iterator it, s64 size, s64 file_count,
+                   const Summary *removed, const Summary *added)
+{
+  if (it == items_.end ())
+    return false;
+  const u64 old_size = it->size;
+  it->size += size;
+  it->file_count += file_count;
+  total_ += size;
+  file_count_ += file_count;
+  if (removed)
+    {
+      if (it->summary)
+        it->summary->subtract (*removed);
+      summary_.subtract (*removed);
+    }
+  if (added)
+    {
+      if (it->summary)
+        it->summary->merge (*added);
+      summary_.merge (*added);
+    }
+  if (it->size > biggest_)
+    biggest_ = it->size;
+  else if (old_size == biggest_)
+    update_biggest ();
+  reposition (static_cast<u32> (it - items_.begin ()));
+  return true;
+}
+
+void
+SpaceInfo::set_stat (const fs::path &name, const struct stat &sb)
+{
+  const auto it = find (name);
+  if (it == items_.end ())
+    return;
+  it->mtime = sb.st_mtime;
+  it->atime = sb.st_atime;
+  it->uid = sb.st_uid;
+  it->gid = sb.st_gid;
+  reposition (static_cast<u32> (it - items_.begin ()));
+}
+
+void
+SpaceInfo::remove (const fs::path &name)
+{
+  const auto it = find (name);
+  if (it == items_.end ())
+    return;
+  const Summary summary = item_summary (*it);
+  const u32 idx = static_cast<u32> (it - items_.begin ());
+  const u64 size = it->size;
+  total_ -= size;
+  file_count_ -= it->file_count;
+  summary_.subtract (summary);
+  if (it->partial)
+    --partial_;
+  unreadable_ -= it->unreadable;
+  index_.erase (it->path.native ());
+  items_.erase (it);
+  for (auto &[_, i] : index_)
+    if (i > idx)
+      --i;
+  for (std::vector<u32> &order : orders_)
+    {
+      std::erase (order, idx);
+      for (u32 &i : order)
+        if (i > idx)
+          --i;
     }
-  items_.insert (
-    std::upper_bound (items_.begin () + 1, items_.end (), item,
-                      [](const Item &a, const Item &b) {
-                        return (a.size == b.size
-                                ? a.path < b.path
-                                : a.size > b.size);
-                      }),
-    std::move (item)
-  );
+  if (size == biggest_)
+    update_biggest ();
+}
+
+void
+SpaceInfo::insert (Item &&item)
+{
+  const u32 idx = static_cast<u32> (items_.size ());
+  index_[item.path.native ()] = idx;
+  items_.push_back (std::move (item));
+  for (usize k = 0; k < orders_.size (); ++k)
+    if (valid_orders_ & (1U << k))
+      {
+        std::vector<u32> &order = orders_[k];
+        const SortKey key = static_cast<SortKey> (k);
+        order.insert (std::upper_bound (order.begin (), order.end (), idx,
+                                        [this, key](u32 a, u32 b) {
+                                          return comes_before (key, a, b);
+                                        }),
+                      idx);
+      }
 }
 
 bool
@@ -67,93 +377,391 @@ can_get_size (const fs::file_status &stat)
 
 template <class IteratorType = fs::directory_iterator, class UnaryFunction>
 static bool
-safe_directory_iterator (const fs::path &path, UnaryFunction f)
+safe_directory_iterator (const fs::path &path, std::error_code &error,
+                         UnaryFunction f,
+                         const std::atomic<bool> *stop = nullptr)
 {
-  auto dir_it = IteratorType (path, G_error);
-  if (G_error)
+  auto dir_it = IteratorType (path, error);
+  if (error)
     return false;
   const auto end = fs::end (dir_it);
-  for (auto it = fs::begin (dir_it); it != end; it.increment (G_error))
+  for (auto it = fs::begin (dir_it); it != end; it.increment (error))
     {
-      if (G_error)
+      if (error)
         return false;
+      if (stop && *stop)
+        break;
       f (*it);
     }
   return true;
 }
 
-u64
-file_size (const fs::directory_entry &entry)
+// Gets the status of an entry, waiting for the throttle first.
+static fs::file_status
+throttled_status (const fs::directory_entry &entry, std::error_code &error)
+{
+  Throttle::acquire ();
+  const Throttle::Clock::time_point start = Throttle::Clock::now ();
+  const fs::file_status status = entry.status (error);
+  Throttle::record (Throttle::Clock::now () - start);
+  return status;
+}
+
+// Returns false and leaves errno set if the entry cannot be stat'ed.
+static bool
+file_stat (const fs::directory_entry &entry, struct stat &sb)
 {
-  struct stat sb;
   if (::lstat (entry.path ().c_str (), &sb) == -1)
+    return false;
+  if (Options::find_duplicates && S_ISREG (sb.st_mode))
+    Duplicates::record (entry.path (), sb);
+  return true;
+}
+
+// Returns a new map for checking the extents of a scan, or null if extents
+// are not checked.
+static std::shared_ptr<ExtentMap>
+extent_map ()
+{
+  if (!Options::extents)
+    return nullptr;
+  return std::make_shared<ExtentMap> (u64 (Options::extents_min) * 1024);
+}
+
+// Adds the file at `path' to `si', with its extents if they get checked.
+static void
+add_file (SpaceInfo &si, const fs::path &path, const struct stat &sb,
+          ExtentMap *extents)
+{
+  if (!extents || !extents->checks (sb))
     {
-      // Hacky but this *should* never fail since we already handeled
-      // permission errors and checked that we can get the size
-      extern void fail ();
-      G_error = std::error_code (errno, std::system_category ());
-      fail ();
-      return 0;
+      si.add_file (path, sb);
+      return;
     }
-  return sb.st_size;
+  auto summary = std::make_unique<Summary> ();
+  summary->add_file (path.filename ().native (), sb);
+  extents->add_file (AT_FDCWD, path.c_str (), sb, summary->extents);
+  si.add (path, sb.st_size, 1, false, nullptr, std::move (summary), &sb);
 }
 
-bool
-directory_size_and_file_count (const fs::path &path, u64 &size, u64 &count)
+// Full paths of the entries being rescanned by `refresh_entry'
+static std::set<fs::path> S_refreshing;
+
+// Returns the limits from the options for a scan starting now.
+static ScanLimits
+scan_limits ()
 {
-  size = count = 0;
-  return safe_directory_iterator<fs::recursive_directory_iterator> (
-    path,
-    [&](const fs::directory_entry &entry) {
-      if (entry.exists () && can_get_size (entry.status ()))
-        {
-          size += file_size (entry);
-          ++count;
-        }
-    }
-  );
+  ScanLimits limits;
+  limits.max_depth = Options::max_depth;
+  if (Options::time_budget)
+    limits.deadline = (std::chrono::steady_clock::now ()
+                       + std::chrono::seconds (Options::time_budget));
+  return limits;
+}
+
+// Returns whether `path' is `dir' or inside it.
+static bool
+is_inside (const fs::path &path, const fs::path &dir)
+{
+  const fs::path rel = path.lexically_relative (dir);
+  return !rel.empty () && *rel.begin () != "..";
 }
 
 SpaceInfo *
 process_dir (const fs::path &path, ProcessingCallback callback)
 {
   const fs::path dev_path = "/dev";
-  u64 size, count;
+  struct stat sb;
 
   if (G_dirs.contains (path))
     {
-      file_system_free = fs::space (path).free;
+      file_system_free = Mounts::free_space (path);
       return &G_dirs[path];
     }
 
+  Age::set_now (std::time (nullptr));
+  Scheduler::drop (path);
+  std::erase_if (S_refreshing, [&path](const fs::path &p) {
+    return p.parent_path () == path;
+  });
+
+  const ScanLimits limits = scan_limits ();
+  std::atomic<bool> stop = false;
+  // Directories already counted, the top level entries take precedence over
+  // links further down that lead to them.
+  std::shared_ptr<VisitedDirs> visited = nullptr;
+  if (Options::follow_symlinks)
+    {
+      visited = std::make_shared<VisitedDirs> ();
+      if (::stat (path.c_str (), &sb) == 0)
+        visited->enter (sb);
+    }
+  const std::shared_ptr<ExtentMap> extents = extent_map ();
+
   SpaceInfo *const si
     = &G_dirs.emplace (std::make_pair (path, SpaceInfo {})).first->second;
   si->add_parent (path.parent_path ());
+  si->set_extent_map (extents);
 
   if (!safe_directory_iterator (
         path,
+        G_error,
         [&](const fs::directory_entry &entry) {
           // See comment in the main function for why this is not supported
+          std::error_code entry_error;
+          const fs::file_status entry_status
+            = throttled_status (entry, entry_error);
           if (entry.path () == dev_path)
             si->add (entry.path (), 0, 0, true, "Not supported");
-          else if (entry.is_directory ())
+          else if (fs::is_directory (entry_status))
             {
-              if (!directory_size_and_file_count (entry.path (), size, count))
-                // ToDo: get the actual error message
-                si->add (entry.path (), 0, 1, true, "Permission denied");
+              struct stat target;
+              if (!file_stat (entry, sb))
+                si->add (entry.path (), 0, 0, true, std::strerror (errno));
+              else if (visited && ::stat (entry.path ().c_str (), &target) == 0
+                       && !visited->enter (target))
+                si->add (entry.path (), 0, 0, true,
+                         "Counted through another link");
               else
-                si->add (entry.path (), size, count, true);
+                {
+                  si->add_pending (entry.path (), sb);
+                  Scheduler::enqueue (path, entry.path ().filename (),
+                                      si->scan_id (), sb.st_dev, limits,
+                                      visited, extents);
+                }
             }
-          else if (entry.exists () && can_get_size (entry.status ()))
-            si->add (entry.path (), file_size (entry));
-          if (callback)
-            callback (*si);
-        }
+          else if (!entry_error && fs::exists (entry_status)
+                   && can_get_size (entry_status))
+            {
+              if (file_stat (entry, sb))
+                add_file (*si, entry.path (), sb, extents.get ());
+              else
+                si->add (entry.path (), 0, 0, false, std::strerror (errno));
+            }
+          if ((callback && !callback (*si))
+              || std::chrono::steady_clock::now () >= limits.deadline)
+            {
+              stop = true;
+              si->set_truncated ();
+            }
+        },
+        &stop
       ))
     {
+      Scheduler::drop (path);
       G_dirs.erase (path);
       return nullptr;
     }
-  file_system_free = fs::space (path).free;
+  file_system_free = Mounts::free_space (path);
   return si;
 }
+
+// Returns the cached directory the scan with the given id belongs to.
+static SpaceInfo *
+scanned_dir (const fs::path &dir, u64 scan_id)
+{
+  const auto it = G_dirs.find (dir);
+  if (it == G_dirs.end () || it->second.scan_id () != scan_id)
+    return nullptr;
+  return &it->second;
+}
+
+// Applies the change of the size and file count of the entry `name' of `dir'
+// to the cached directories containing `dir'.
+static void
+propagate (const fs::path &dir, const fs::path &name, s64 size,
+           s64 file_count, const Summary *removed, const Summary *added)
+{
+  const fs::path path = dir / name;
+  for (auto &[ancestor, si] : G_dirs)
+    if (ancestor != dir && is_inside (dir, ancestor))
+      si.update (*path.lexically_relative (ancestor).begin (), size,
+                 file_count, removed, added);
+}
+
+bool
+refresh_entry (const fs::path &dir, const fs::path &name)
+{
+  const auto it = G_dirs.find (dir);
+  const fs::path path = dir / name;
+  if (it == G_dirs.end () || S_refreshing.contains (path))
+    return false;
+  SpaceInfo &si = it->second;
+  usize idx = si.index_of (name);
+  if (idx == 0)
+    return false;
+  // Cached directories inside the entry would be out of date
+  std::erase_if (G_dirs, [&path](const auto &entry) {
+    return is_inside (entry.first, path);
+  });
+  // The files get recorded again by the rescan
+  if (Options::find_duplicates)
+    Duplicates::forget (path);
+  struct stat sb;
+  if (::lstat (path.c_str (), &sb) == -1)
+    {
+      apply_removal (path, si[idx].size, si[idx].file_count, true);
+      return true;
+    }
+  // Classified like the listing does, links to directories count as
+  // directories
+  struct stat target;
+  const bool is_link_to_dir = (S_ISLNK (sb.st_mode)
+                               && ::stat (path.c_str (), &target) == 0
+                               && S_ISDIR (target.st_mode));
+  const bool follow = Options::follow_symlinks && is_link_to_dir;
+  const bool is_directory = S_ISDIR (sb.st_mode) || is_link_to_dir;
+  const bool replaced = is_directory != si[idx].is_directory;
+  if (replaced)
+    {
+      // Replaced by an entry of the other type, which starts from scratch
+      apply_removal (path, si[idx].size, si[idx].file_count, true);
+      if (!is_directory)
+        {
+          add_file (si, path, sb, si.extent_map ().get ());
+          const Summary added = si.summary_of (si.index_of (name));
+          propagate (dir, name, sb.st_size, 1, nullptr, &added);
+        }
+      else
+        {
+          si.add_pending (path, sb);
+          idx = si.index_of (name);
+        }
+    }
+  // Only now, the removal forgets everything at the path
+  if (Options::find_duplicates && S_ISREG (sb.st_mode))
+    Duplicates::record (path, sb);
+  if (replaced && !is_directory)
+    return true;
+  if (is_directory)
+    {
+      // Keeps the old size until the result is in
+      si.set (name, si[idx].size, si[idx].file_count, true);
+      S_refreshing.insert (path);
+      // Only knows about the links inside the entry itself
+      std::shared_ptr<VisitedDirs> visited = nullptr;
+      if (Options::follow_symlinks)
+        {
+          visited = std::make_shared<VisitedDirs> ();
+          if (follow || ::stat (path.c_str (), &target) == 0)
+            visited->enter (target);
+        }
+      Scheduler::enqueue (dir, name, si.scan_id (), sb.st_dev, scan_limits (),
+                          visited, si.extent_map ());
+      return true;
+    }
+  const Summary old_summary = si.summary_of (idx);
+  Summary new_summary;
+  new_summary.add_file (name.native (), sb);
+  if (ExtentMap *const extents = si.extent_map ().get ();
+      extents && extents->checks (sb))
+    {
+      ExtentUsage &usage = new_summary.extents;
+      extents->add_file (AT_FDCWD, path.c_str (), sb, usage);
+      // The map already knows the shared extents the file had before, they
+      // stay allocated to it
+      const ExtentUsage &old = old_summary.extents;
+      usage.allocated = usage.exclusive
+                        + std::min (usage.shared,
+                                    usage.allocated - usage.exclusive
+                                      + old.allocated - old.exclusive);
+    }
+  const s64 size = static_cast<s64> (sb.st_size - si[idx].size);
+  si.set_stat (name, sb);
+  si.update (name, size, 0, &old_summary, &new_summary);
+  propagate (dir, name, size, 0, &old_summary, &new_summary);
+  return true;
+}
+
+bool
+apply_scan_results ()
+{
+  bool changed = false;
+  for (const Scheduler::Progress &p : Scheduler::running ())
+    if (SpaceInfo *si = scanned_dir (p.dir, p.scan_id);
+        si && !S_refreshing.contains (p.dir / p.name))
+      {
+        // Estimates are not lower bounds, the margin tells how far off they
+        // may be instead.
+        changed |= si->set (p.name, p.size, p.file_count, !Options::estimate);
+        si->set_margin (p.name, p.margin);
+      }
+  for (Scheduler::Result &r : Scheduler::finished ())
+    if (SpaceInfo *si = scanned_dir (r.dir, r.scan_id))
+      {
+        // The change of a refreshed entry also goes to the ancestors
+        std::optional<Summary> old_summary;
+        u64 old_size = 0, old_count = 0;
+        const bool refreshed = S_refreshing.erase (r.dir / r.name);
+        if (const usize idx = si->index_of (r.name); refreshed && idx)
+          {
+            old_summary = si->summary_of (idx);
+            old_size = (*si)[idx].size;
+            old_count = (*si)[idx].file_count;
+          }
+        if (r.status == ScanStatus::Failed)
+          si->set (r.name, 0, 1, false, nullptr,
+                   std::strerror (r.errors.first));
+        else
+          {
+            si->set (r.name, r.size, r.file_count,
+                     r.status == ScanStatus::Truncated, std::move (r.summary));
+            si->set_unreadable (r.name, r.errors.count, r.errors.first);
+          }
+        if (old_summary)
+          {
+            const usize idx = si->index_of (r.name);
+            const Summary new_summary = si->summary_of (idx);
+            propagate (r.dir, r.name,
+                       static_cast<s64> ((*si)[idx].size - old_size),
+                       static_cast<s64> ((*si)[idx].file_count - old_count),
+                       &*old_summary, &new_summary);
+          }
+        si->set_margin (r.name, r.margin);
+        changed = true;
+      }
+  return changed;
+}
+
+void
+finish_scans ()
+{
+  Scheduler::wait ();
+  apply_scan_results ();
+}
+
+void
+apply_removal (const fs::path &path, u64 size, u64 file_count, bool complete)
+{
+  const fs::path parent = path.parent_path ();
+  const fs::path name = path.filename ();
+  std::optional<Summary> removed;
+  if (complete && G_dirs.contains (parent))
+    {
+      const SpaceInfo &si = G_dirs[parent];
+      if (const usize idx = si.index_of (name))
+        removed = si.summary_of (idx);
+    }
+  for (auto &[dir, si] : G_dirs)
+    {
+      const fs::path rel = path.lexically_relative (dir);
+      if (rel.empty () || rel == "." || *rel.begin () == "..")
+        continue;
+      const fs::path child = *rel.begin ();
+      if (complete && dir == parent)
+        si.remove (child);
+      else
+        si.update (child, -static_cast<s64> (size),
+                   -static_cast<s64> (file_count),
+                   removed ? &*removed : nullptr);
+    }
+  if (Options::find_duplicates)
+    Duplicates::forget (path, !complete);
+  Mounts::invalidate ();
+  file_system_free = Mounts::free_space (parent);
+  // Cached directories inside the removed one
+  std::erase_if (G_dirs, [&path](const auto &entry) {
+    const fs::path rel = entry.first.lexically_relative (path);
+    return !rel.empty () && *rel.begin () != "..";
+  });
+}
@@ -1,6 +1,25 @@
 #pragma once
 #include "stdafx.hh"
+#include "summary.hh"
+#include "walk.hh"
 
+enum class SortKey : u8
+{
+  // Biggest first
+  Size,
+  // Alphabetical
+  Name,
+  // Most files first
+  FileCount,
+  // Most recently modified first
+  Modified,
+  COUNT
+};
+
+// Items are stored in the order they were added in.  The sorted orders are
+// built lazily as permutations of their indices and cached until items get
+// added or removed, so switching between them or reversing them is cheap.
+// Items are found by name through a map to their index.
 class SpaceInfo
 {
   struct Item
@@ -10,6 +29,24 @@ class SpaceInfo
     bool is_directory : 1;
     const char *error = nullptr;
     const char *display_name = nullptr;
+    // Only set for directories
+    std::unique_ptr<Summary> summary = nullptr;
+    time_t mtime = 0;
+    time_t atime = 0;
+    u64 file_count = 0;
+    uid_t uid = 0;
+    gid_t gid = 0;
+    // Set while the size of a directory is still being computed, the size
+    // is a lower bound until then.
+    bool partial = false;
+    // Half width of the 95% confidence interval of the size if it is
+    // estimated, 0 if the size is exact.
+    u64 margin = 0;
+    // Number of entries below a directory that could not be read, the size
+    // is a lower bound if there are any.
+    u64 unreadable = 0;
+    // errno of the first of them
+    int read_error = 0;
   };
 
 public:
@@ -24,22 +61,115 @@ public:
 
   void
   add (const fs::path &path, u64 size, u64 file_count = 1,
-       bool is_directory = false, const char *error = nullptr);
+       bool is_directory = false, const char *error = nullptr,
+       std::unique_ptr<Summary> summary = nullptr,
+       const struct stat *sb = nullptr);
+
+  void
+  add_file (const fs::path &path, const struct stat &sb);
+
+  // Adds a directory whose size will be set later using `set'.
+  void
+  add_pending (const fs::path &path, const struct stat &sb);
+
+  // Sets the size and file count of the item with the given name and whether
+  // they are only lower bounds.  The summary replaces the current one if
+  // given.  Returns false if there is no such item.
+  bool
+  set (const fs::path &name, u64 size, u64 file_count, bool partial,
+       std::unique_ptr<Summary> summary = nullptr,
+       const char *error = nullptr);
+
+  // Sets the number of entries below the item with the given name that could
+  // not be read and the error of the first one.
+  void
+  set_unreadable (const fs::path &name, u64 count, int error);
 
+  // Sets the margin of error of the size of the item with the given name.
   void
-  sort (bool ascending = false);
+  set_margin (const fs::path &name, u64 margin);
+
+  // Changes the size and file count of the item with the given name and
+  // moves it to its new position in the current sort order.  If `removed' or
+  // `added' are given they are subtracted from or merged into the summaries.
+  // Returns false if there is no such item.
+  bool
+  update (const fs::path &name, s64 size, s64 file_count,
+          const Summary *removed = nullptr, const Summary *added = nullptr);
+
+  // Takes the times and owner of the item with the given name from `sb'.
+  // Its summary is left alone, `update' is where changes to it go.
+  void
+  set_stat (const fs::path &name, const struct stat &sb);
+
+  // Removes the item with the given name and its size from the totals.
+  void
+  remove (const fs::path &name);
+
+  // Returns the index of the item with the given name or 0 if there is no
+  // such item.
+  usize
+  index_of (const fs::path &name) const;
+
+  // Selects the order the items are indexed in.  If `cold_days' is not 0
+  // sorting by size uses the number of bytes not modified or accessed in
+  // that many days instead.
+  void
+  sort (SortKey key = SortKey::Size, bool reversed = false, u32 cold_days = 0);
+
+  SortKey sort_key () const { return key_; }
 
   u64 total () const { return total_; }
   u64 biggest () const { return biggest_; }
   u64 total_file_count () const { return file_count_; }
   u64 item_count () const { return items_.size () - 1; }
+  u64 partial_count () const { return partial_; }
+  // Number of entries that could not be read and the error of the first one
+  u64 unreadable_count () const { return unreadable_; }
+  int read_error () const { return read_error_; }
+  // Whether the totals are only lower bounds because items are partial or
+  // incomplete or the listing was stopped early.
+  bool is_lower_bound () const { return partial_ || unreadable_ || truncated_; }
+  void set_truncated () { truncated_ = true; }
+  // Margin of error of the total, assuming the estimates of the items are
+  // independent.
+  u64 total_margin () const;
+  // Identifies this scan of the directory, the results of scheduled tasks
+  // only get applied to the scan that queued them.
+  u64 scan_id () const { return scan_id_; }
+  const Summary & summary () const { return summary_; }
+  // Shared extents found by the scan of the directory, if extents are
+  // checked.  Rescans of its entries use the same map.
+  const std::shared_ptr<ExtentMap> & extent_map () const { return extent_map_; }
+  void
+  set_extent_map (std::shared_ptr<ExtentMap> map)
+  { extent_map_ = std::move (map); }
+
+  // Returns the summary for the subtree of the item at the given index, for
+  // the parent entry this is the summary of the entire directory.
+  Summary
+  summary_of (usize idx) const;
 
+  // Iterates the items in the order they were added in, use indexing to
+  // get them in the sorted order.
   const_iterator begin () const { return items_.cbegin (); }
   const_iterator end () const { return items_.cend (); }
 
+  // Returns the item at the given position in the current sort order, the
+  // parent entry is always at 0.
   const Item &
   operator[] (usize idx) const
-  { return items_[idx]; }
+  {
+    if (idx == 0)
+      return items_[0];
+    const std::vector<u32> &order = this->order ();
+    return items_[order[reversed_ ? order.size () - idx : idx - 1]];
+  }
+
+  // Returns the number of bytes below the item that have not been modified
+  // or accessed in the given number of days.
+  u64
+  cold_bytes (const Item &item, u32 days) const;
 
   f64
   size_relative_to_biggest (const Item &item) const
@@ -50,16 +180,63 @@ public:
   { return total_ ? (static_cast<f64> (item.size) / total_) : 1.0; }
 
 private:
-  void insert_sorted (Item &&);
+  void insert (Item &&);
+
+  iterator find (const fs::path &name);
+
+  bool update (iterator it, s64 size, s64 file_count, const Summary *removed,
+               const Summary *added);
+
+  static Summary item_summary (const Item &item);
+
+  // Whether the item at index `a' comes before the one at `b' when sorting by
+  // the given key.
+  bool comes_before (SortKey key, u32 a, u32 b) const;
+
+  // Returns the permutation for the current sort key, building it if needed.
+  const std::vector<u32> & order () const;
+
+  // Moves the item at the given index to its new position in the cached
+  // orders that depend on its size or times, assuming all other items are
+  // sorted.
+  void reposition (u32 idx);
+
+  void update_biggest ();
 
 private:
   u64 file_count_ {0};
   u64 biggest_ {0};
   u64 total_ {0};
   items_type items_ {};
+  // Index in `items_' of the item with the given name
+  std::unordered_map<std::string, u32> index_ {};
+  Summary summary_ {};
+  SortKey key_ {SortKey::Size};
+  bool reversed_ {false};
+  u32 cold_days_ {0};
+  // Indices of the items without the parent entry, for each sort key, and
+  // which of them are up to date
+  mutable std::array<std::vector<u32>, static_cast<usize> (SortKey::COUNT)>
+    orders_ {};
+  mutable u8 valid_orders_ {0};
+  u64 partial_ {0};
+  u64 unreadable_ {0};
+  int read_error_ {0};
+  bool truncated_ {false};
+  u64 scan_id_ {next_scan_id ()};
+  std::shared_ptr<ExtentMap> extent_map_ {};
+
+  static u64
+  next_scan_id ()
+  {
+    static u64 S_id = 0;
+    return ++S_id;
+  }
 };
 
-using ProcessingCallback = std::function<void (const SpaceInfo &)>;
+// Called for every entry while listing a directory, returning false stops
+// the listing.
+using ProcessingCallback = std::function<bool (const SpaceInfo &)>;
 
 inline std::map<fs::path, SpaceInfo> G_dirs;
 
@@ -69,7 +246,28 @@ extern u64 file_system_free;
 
 bool can_get_size (const fs::file_status &stat);
 
-std::pair<u64, u64> directory_size_and_file_count (const fs::path &path);
-
+// Lists the directory and queues its subdirectories on the scheduler, their
+// sizes get filled in by `apply_scan_results'.  The depth and time limits
+// from the options apply to the listing and all queued scans.
 SpaceInfo * process_dir (const fs::path &path,
                          ProcessingCallback callback = nullptr);
+
+// Updates cached directories with the progress and results of scheduled
+// scans.  Returns whether anything changed.
+bool apply_scan_results ();
+
+// Blocks until all scheduled scans are done and applies their results.
+void finish_scans ();
+
+// Rescans the entry `name' of the cached directory `dir', a directory in the
+// background.  The change of its size is applied to `dir' and all cached
+// directories containing it, cached directories inside the entry are
+// forgotten.  Returns false if there is no such entry or it is already being
+// rescanned.
+bool refresh_entry (const fs::path &dir, const fs::path &name);
+
+// Subtracts the size and file count of a removed file or directory from all
+// cached directories containing it and forgets about cached directories
+// inside it.  `complete' says whether everything below the path was removed.
+void apply_removal (const fs::path &path, u64 size, u64 file_count,
+                    bool complete);
@@ -7,21 +7,39 @@
 #include <cstring>
 #include <cerrno>
 #include <cstdarg>
+#include <ctime>
 
 #include <string>
 #include <string_view>
 #include <vector>
+#include <array>
 #include <map>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <deque>
+#include <memory>
+#include <memory_resource>
+#include <algorithm>
+#include <numeric>
 #include <functional>
 #include <list>
+#include <optional>
+#include <utility>
+#include <limits>
+#include <bit>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <chrono>
 
 #include <filesystem>
 #include <system_error>
 
 #include <sys/types.h>
 #include <sys/stat.h>
-
-#include <ncurses.h>
+#include <dirent.h>
 
 using u8 = std::uint8_t;
 using u16 = std::uint16_t;
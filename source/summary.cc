@@ -0,0 +1,295 @@
+#include "summary.hh"
+#include "encoding.hh"
+
+namespace Extension
+{
+// Extensions longer than this are most likely not file types but parts of
+// generated names, these all get counted as `OTHER'.
+constexpr usize MAX_LENGTH = 16;
+
+static std::deque<std::string> S_names {"(none)", "(symlink)", "(other)"};
+static std::unordered_map<std::string_view, u32> S_ids;
+// Extensions get interned by the scanner threads
+static std::mutex S_mutex;
+
+u32
+intern (std::string_view ext)
+{
+  std::lock_guard lock (S_mutex);
+  if (S_ids.empty ())
+    for (u32 i = 0; i < S_names.size (); ++i)
+      S_ids.emplace (S_names[i], i);
+  if (const auto it = S_ids.find (ext); it != S_ids.end ())
+    return it->second;
+  const u32 id = S_names.size ();
+  S_ids.emplace (S_names.emplace_back (ext), id);
+  return id;
+}
+
+u32
+of (std::string_view file_name)
+{
+  char buf[MAX_LENGTH];
+  usize dot;
+  for (;;)
+    {
+      dot = file_name.rfind ('.');
+      // No extension or a dotfile
+      if (dot == std::string_view::npos || dot == 0)
+        return NONE;
+      const std::string_view ext = file_name.substr (dot + 1);
+      if (ext.empty ()
+          || !std::all_of (ext.begin (), ext.end (), [](unsigned char c) {
+               return std::isdigit (c);
+             }))
+        break;
+      file_name = file_name.substr (0, dot);
+    }
+  const std::string_view ext = file_name.substr (dot);
+  if (ext.size () > MAX_LENGTH)
+    return OTHER;
+  std::transform (ext.begin (), ext.end (), buf, [](unsigned char c) {
+    return static_cast<char> (std::tolower (c));
+  });
+  return intern ({buf, ext.size ()});
+}
+
+const std::string &
+name (u32 id)
+{
+  std::lock_guard lock (S_mutex);
+  return S_names[id];
+}
+}
+
+namespace Age
+{
+static std::atomic<time_t> S_now = std::time (nullptr);
+
+void
+set_now (time_t now)
+{
+  S_now = now;
+}
+
+u32
+days_since (time_t time)
+{
+  const time_t now = S_now;
+  return time < now ? (now - time) / (24 * 60 * 60) : 0;
+}
+
+usize
+bucket (u32 days)
+{
+  return (std::upper_bound (BUCKET_DAYS.begin (), BUCKET_DAYS.end (), days)
+          - BUCKET_DAYS.begin () - 1);
+}
+
+std::string
+bucket_name (usize bucket)
+{
+  if (bucket + 1 == BUCKETS)
+    return std::to_string (BUCKET_DAYS[bucket]) + "+ days";
+  return (std::to_string (BUCKET_DAYS[bucket]) + "-"
+          + std::to_string (BUCKET_DAYS[bucket + 1]) + " days");
+}
+}
+
+namespace FileSize
+{
+u8
+bucket (u64 size)
+{
+  return std::min<usize> (std::bit_width (size), BUCKETS - 1);
+}
+
+u64
+bucket_min (usize bucket)
+{
+  return bucket ? 1ULL << (bucket - 1) : 0;
+}
+
+// Formats a power of two with a binary unit.
+static std::string
+power_name (u64 size)
+{
+  static constexpr const char *UNITS[] = {"", "K", "M", "G", "T", "P", "E"};
+  const unsigned exponent = std::countr_zero (size);
+  return (std::to_string (1ULL << (exponent % 10))
+          + UNITS[exponent / 10]);
+}
+
+std::string
+bucket_name (usize bucket)
+{
+  if (bucket == 0)
+    return "empty";
+  if (bucket + 1 == BUCKETS)
+    return power_name (bucket_min (bucket)) + "+";
+  return (power_name (bucket_min (bucket)) + "-"
+          + power_name (bucket_min (bucket + 1)));
+}
+}
+
+u64
+AgeHistogram::bytes_older_than (u32 days) const
+{
+  // The bucket containing `days' also contains younger data unless it starts
+  // exactly at `days'.
+  usize first = Age::bucket (days);
+  if (Age::BUCKET_DAYS[first] < days)
+    ++first;
+  u64 total = 0;
+  for (usize i = first; i < Age::BUCKETS; ++i)
+    total += bytes[i];
+  return total;
+}
+
+void
+Summary::add_file (std::string_view name, const struct stat &sb)
+{
+  u32 ext;
+  if (S_ISLNK (sb.st_mode))
+    ext = Extension::SYMLINK;
+  else if (S_ISREG (sb.st_mode))
+    ext = Extension::of (name);
+  else
+    ext = Extension::OTHER;
+  extensions.add (ext, sb.st_size);
+  const u32 mdays = Age::days_since (sb.st_mtime);
+  const u32 adays = Age::days_since (sb.st_atime);
+  modified.add (mdays, sb.st_size);
+  accessed.add (adays, sb.st_size);
+  idle.add (std::min (mdays, adays), sb.st_size);
+  users.add (sb.st_uid, sb.st_size);
+  groups.add (sb.st_gid, sb.st_size);
+  sizes.add (FileSize::bucket (sb.st_size), sb.st_size);
+}
+
+void
+Summary::merge (const Summary &other)
+{
+  extensions.merge (other.extensions);
+  modified.merge (other.modified);
+  accessed.merge (other.accessed);
+  idle.merge (other.idle);
+  users.merge (other.users);
+  groups.merge (other.groups);
+  sizes.merge (other.sizes);
+  extents.merge (other.extents);
+}
+
+void
+Summary::subtract (const Summary &other)
+{
+  extensions.subtract (other.extensions);
+  modified.subtract (other.modified);
+  accessed.subtract (other.accessed);
+  idle.subtract (other.idle);
+  users.subtract (other.users);
+  groups.subtract (other.groups);
+  sizes.subtract (other.sizes);
+  extents.subtract (other.extents);
+}
+
+void
+Summary::shrink ()
+{
+  extensions.shrink ();
+  users.shrink ();
+  groups.shrink ();
+  sizes.shrink ();
+}
+
+template <class Key>
+static void
+encode_tally (Encoder &enc, const Tally<Key> &tally)
+{
+  enc.uint (tally.size ());
+  for (const auto &e : tally)
+    {
+      enc.uint (e.key);
+      enc.uint (e.count);
+      enc.uint (e.bytes);
+    }
+}
+
+template <class Key>
+static void
+decode_tally (Decoder &dec, Tally<Key> &tally,
+              u64 max_key = std::numeric_limits<Key>::max ())
+{
+  for (u64 n = dec.uint (); n && dec.ok (); --n)
+    {
+      const Key key = dec.uint (max_key);
+      const u64 count = dec.uint ();
+      tally.add (key, dec.uint (), count);
+    }
+}
+
+static void
+encode_ages (Encoder &enc, const AgeHistogram &hist)
+{
+  for (usize i = 0; i < Age::BUCKETS; ++i)
+    {
+      enc.uint (hist.count[i]);
+      enc.uint (hist.bytes[i]);
+    }
+}
+
+static void
+decode_ages (Decoder &dec, AgeHistogram &hist)
+{
+  for (usize i = 0; i < Age::BUCKETS; ++i)
+    {
+      hist.count[i] = dec.uint ();
+      hist.bytes[i] = dec.uint ();
+    }
+}
+
+void
+Summary::encode (Encoder &enc) const
+{
+  // Extension ids are local to the process so they are sent by name.
+  enc.uint (extensions.size ());
+  for (const auto &e : extensions)
+    {
+      enc.string (Extension::name (e.key));
+      enc.uint (e.count);
+      enc.uint (e.bytes);
+    }
+  encode_ages (enc, modified);
+  encode_ages (enc, accessed);
+  encode_ages (enc, idle);
+  encode_tally (enc, users);
+  encode_tally (enc, groups);
+  encode_tally (enc, sizes);
+  enc.uint (extents.files);
+  enc.uint (extents.exclusive);
+  enc.uint (extents.shared);
+  enc.uint (extents.allocated);
+}
+
+bool
+Summary::decode (Decoder &dec)
+{
+  for (u64 n = dec.uint (); n && dec.ok (); --n)
+    {
+      const u32 ext = Extension::intern (dec.string ());
+      const u64 count = dec.uint ();
+      extensions.add (ext, dec.uint (), count);
+    }
+  decode_ages (dec, modified);
+  decode_ages (dec, accessed);
+  decode_ages (dec, idle);
+  decode_tally (dec, users);
+  decode_tally (dec, groups);
+  decode_tally (dec, sizes, FileSize::BUCKETS - 1);
+  extents.files = dec.uint ();
+  extents.exclusive = dec.uint ();
+  extents.shared = dec.uint ();
+  extents.allocated = dec.uint ();
+  shrink ();
+  return dec.ok ();
+}
@@ -0,0 +1,233 @@
+#pragma once
+#include "stdafx.hh"
+
+// Bytes and file counts accumulated per key, stored as a flat vector sorted
+// by key.  Subtrees usually only have a handful of distinct keys so this
+// stays much smaller than a node based map.
+template <class Key>
+class Tally
+{
+public:
+  struct Entry
+  {
+    Key key;
+    u64 count;
+    u64 bytes;
+  };
+
+  using entries_type = std::vector<Entry>;
+  using const_iterator = typename entries_type::const_iterator;
+
+public:
+  void
+  add (Key key, u64 bytes, u64 count = 1)
+  {
+    auto it = lower_bound (key);
+    if (it == entries_.end () || it->key != key)
+      it = entries_.insert (it, Entry {key, 0, 0});
+    it->count += count;
+    it->bytes += bytes;
+  }
+
+  void
+  merge (const Tally &other)
+  {
+    for (const Entry &e : other.entries_)
+      add (e.key, e.bytes, e.count);
+  }
+
+  void
+  subtract (const Tally &other)
+  {
+    for (const Entry &e : other.entries_)
+      {
+        const auto it = lower_bound (e.key);
+        if (it == entries_.end () || it->key != e.key)
+          continue;
+        it->bytes -= std::min (it->bytes, e.bytes);
+        it->count -= std::min (it->count, e.count);
+        if (it->count == 0)
+          entries_.erase (it);
+      }
+  }
+
+  void
+  shrink ()
+  { entries_.shrink_to_fit (); }
+
+  bool empty () const { return entries_.empty (); }
+  usize size () const { return entries_.size (); }
+
+  const_iterator begin () const { return entries_.cbegin (); }
+  const_iterator end () const { return entries_.cend (); }
+
+private:
+  typename entries_type::iterator
+  lower_bound (Key key)
+  {
+    return std::lower_bound (entries_.begin (), entries_.end (), key,
+                             [](const Entry &e, Key k) { return e.key < k; });
+  }
+
+private:
+  entries_type entries_ {};
+};
+
+namespace Extension
+{
+// Reserved ids for entries that do not get classified by their extension.
+constexpr u32 NONE = 0;
+constexpr u32 SYMLINK = 1;
+constexpr u32 OTHER = 2;
+
+// Returns the interned id of the extension of the given file name.
+// Trailing numeric extensions (as in `syslog.2' or `core.1234') are skipped.
+u32 of (std::string_view file_name);
+
+const std::string & name (u32 id);
+
+// Returns the id for the given extension, as returned by `name'.
+u32 intern (std::string_view ext);
+}
+
+namespace Age
+{
+// Lower bounds in days of the age buckets.  The buckets get wider with age
+// and line up with the usual data tiering thresholds.
+constexpr std::array<u32, 9> BUCKET_DAYS = {0, 1, 7, 30, 90, 180, 365, 730,
+                                            1825};
+constexpr usize BUCKETS = BUCKET_DAYS.size ();
+
+// Sets the point in time ages are measured from, this should be called once
+// at the start of each scan.
+void set_now (time_t now);
+
+u32 days_since (time_t time);
+
+usize bucket (u32 days);
+
+// Returns a string describing the range of ages in the given bucket.
+std::string bucket_name (usize bucket);
+}
+
+namespace FileSize
+{
+// Files are counted in buckets between powers of two, bucket 0 holds empty
+// files and bucket b > 0 the sizes from 2^(b-1) up to 2^b.  Everything from
+// 2^(BUCKETS-2) on goes into the last bucket, so a tally of the buckets never
+// has more than BUCKETS entries.
+constexpr usize BUCKETS = 42;
+
+u8 bucket (u64 size);
+
+// Returns the smallest size in the given bucket.
+u64 bucket_min (usize bucket);
+
+// Returns a string describing the range of sizes in the given bucket.
+std::string bucket_name (usize bucket);
+}
+
+// Bytes and file counts per age bucket.
+struct AgeHistogram
+{
+  std::array<u64, Age::BUCKETS> bytes {};
+  std::array<u64, Age::BUCKETS> count {};
+
+  void
+  add (u32 days, u64 size)
+  {
+    const usize b = Age::bucket (days);
+    bytes[b] += size;
+    ++count[b];
+  }
+
+  void
+  merge (const AgeHistogram &other)
+  {
+    for (usize i = 0; i < Age::BUCKETS; ++i)
+      {
+        bytes[i] += other.bytes[i];
+        count[i] += other.count[i];
+      }
+  }
+
+  void
+  subtract (const AgeHistogram &other)
+  {
+    for (usize i = 0; i < Age::BUCKETS; ++i)
+      {
+        bytes[i] -= std::min (bytes[i], other.bytes[i]);
+        count[i] -= std::min (count[i], other.count[i]);
+      }
+  }
+
+  // Returns the number of bytes in all buckets that only contain ages of at
+  // least the given number of days.
+  u64 bytes_older_than (u32 days) const;
+};
+
+// Bytes in the extents of the files that had them checked, see `ExtentMap'.
+// Deleting the files frees at least the exclusive bytes.
+struct ExtentUsage
+{
+  u64 files = 0;
+  u64 exclusive = 0;
+  // Extents also used by other files, like reflinked copies, counted for
+  // every file using them
+  u64 shared = 0;
+  // Exclusive bytes plus the shared extents the scan found here first, so
+  // the extents shared by several of the files count once
+  u64 allocated = 0;
+
+  void
+  merge (const ExtentUsage &other)
+  {
+    files += other.files;
+    exclusive += other.exclusive;
+    shared += other.shared;
+    allocated += other.allocated;
+  }
+
+  void
+  subtract (const ExtentUsage &other)
+  {
+    files -= std::min (files, other.files);
+    exclusive -= std::min (exclusive, other.exclusive);
+    shared -= std::min (shared, other.shared);
+    allocated -= std::min (allocated, other.allocated);
+  }
+};
+
+class Encoder;
+class Decoder;
+
+// Information about a subtree that is collected during the scan, in
+// addition to its size and file count.
+struct Summary
+{
+  Tally<u32> extensions;
+  AgeHistogram modified;
+  AgeHistogram accessed;
+  // Age of the most recent modification or access, this is what decides
+  // whether data is cold.
+  AgeHistogram idle;
+  Tally<uid_t> users;
+  Tally<gid_t> groups;
+  // By `FileSize::bucket'
+  Tally<u8> sizes;
+  // Only filled in by scans that check extents
+  ExtentUsage extents;
+
+  void add_file (std::string_view name, const struct stat &sb);
+
+  void merge (const Summary &other);
+
+  void subtract (const Summary &other);
+
+  void shrink ();
+
+  void encode (Encoder &enc) const;
+
+  // Returns false if the data was malformed.
+  bool decode (Decoder &dec);
+};
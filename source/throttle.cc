@@ -0,0 +1,128 @@
+#include "throttle.hh"
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace Throttle
+{
+// Lowest rate adaptive throttling backs off to
+static constexpr f64 MIN_RATE = 50.0;
+// Latencies are averaged over windows of this length
+static constexpr auto WINDOW = std::chrono::milliseconds (200);
+// Windows with fewer samples are too noisy to judge the latency
+static constexpr u64 MIN_SAMPLES = 16;
+// The rate gets halved when the latency exceeds the baseline by this factor
+// and grows again while it stays below the second one.
+static constexpr f64 CONGESTED = 2.0;
+static constexpr f64 RELAXED = 1.25;
+static constexpr f64 GROWTH = 1.1;
+// Lets the baseline follow lasting changes of the latency
+static constexpr f64 BASELINE_DRIFT = 1.02;
+
+static constexpr f64 UNLIMITED = std::numeric_limits<f64>::infinity ();
+
+static std::mutex S_mutex;
+static bool S_enabled = false;
+static bool S_adaptive = false;
+static f64 S_limit = UNLIMITED;
+static f64 S_rate = UNLIMITED;
+static f64 S_tokens = 0.0;
+static Clock::time_point S_refilled;
+static Clock::time_point S_window_start;
+static u64 S_window_samples = 0;
+static f64 S_window_latency = 0.0;
+static f64 S_baseline = UNLIMITED;
+
+void
+configure (unsigned max_rate, bool adaptive)
+{
+  S_limit = S_rate = max_rate ? max_rate : UNLIMITED;
+  S_adaptive = adaptive;
+  S_enabled = max_rate || adaptive;
+  S_refilled = S_window_start = Clock::now ();
+}
+
+bool
+set_idle_priority ()
+{
+#ifdef SYS_ioprio_set
+  // From linux/ioprio.h which is not exposed by libc
+  constexpr int IOPRIO_WHO_PROCESS = 1;
+  constexpr int IOPRIO_CLASS_IDLE = 3;
+  constexpr int IOPRIO_CLASS_SHIFT = 13;
+  // With who=process a pid of 0 selects the calling thread
+  return ::syscall (SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+                    IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) == 0;
+#else
+  errno = ENOSYS;
+  return false;
+#endif
+}
+
+void
+acquire ()
+{
+  if (!S_enabled)
+    return;
+  std::unique_lock lock (S_mutex);
+  if (S_rate == UNLIMITED)
+    return;
+  const Clock::time_point now = Clock::now ();
+  const f64 elapsed = std::chrono::duration<f64> (now - S_refilled).count ();
+  // Allow bursts of a tenth of a second worth of entries
+  S_tokens = std::min (std::max (1.0, S_rate / 10.0),
+                       S_tokens + elapsed * S_rate);
+  S_refilled = now;
+  // Taking the token even if there is none yet makes concurrent callers wait
+  // for consecutive tokens instead of all waking up for the same one.
+  S_tokens -= 1.0;
+  if (S_tokens >= 0.0)
+    return;
+  const std::chrono::duration<f64> wait (-S_tokens / S_rate);
+  lock.unlock ();
+  std::this_thread::sleep_for (wait);
+}
+
+// Adjusts the rate at the end of a window.
+static void
+adapt (Clock::time_point now)
+{
+  const f64 seconds = std::chrono::duration<f64> (now - S_window_start).count ();
+  const f64 latency = S_window_latency / S_window_samples;
+  const f64 throughput = S_window_samples / seconds;
+  if (latency > S_baseline * CONGESTED)
+    S_rate = std::max (MIN_RATE, std::min (S_rate, throughput) / 2.0);
+  else if (latency < S_baseline * RELAXED && S_rate != UNLIMITED)
+    {
+      S_rate *= GROWTH;
+      // Once the rate is no longer the bottleneck it can be lifted entirely
+      if (S_rate >= S_limit || S_rate > throughput * 2.0)
+        S_rate = S_limit;
+    }
+  S_baseline = std::min (latency, S_baseline * BASELINE_DRIFT);
+  S_window_start = now;
+  S_window_samples = 0;
+  S_window_latency = 0.0;
+}
+
+void
+record (Clock::duration latency)
+{
+  if (!S_adaptive)
+    return;
+  std::lock_guard lock (S_mutex);
+  ++S_window_samples;
+  S_window_latency += std::chrono::duration<f64> (latency).count ();
+  const Clock::time_point now = Clock::now ();
+  if (now - S_window_start < WINDOW)
+    return;
+  if (S_window_samples >= MIN_SAMPLES)
+    adapt (now);
+}
+
+f64
+rate ()
+{
+  std::lock_guard lock (S_mutex);
+  return S_rate == UNLIMITED ? 0.0 : S_rate;
+}
+}
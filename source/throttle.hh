@@ -0,0 +1,31 @@
+#pragma once
+#include "stdafx.hh"
+
+// Limits the rate at which scans touch file system entries so they can run
+// next to latency sensitive workloads.  The limit is a token bucket shared by
+// all scanning threads, with adaptive throttling it also backs off whenever
+// the latency of stat calls rises above what was observed earlier.
+namespace Throttle
+{
+using Clock = std::chrono::steady_clock;
+
+// Sets the maximum number of entries per second, 0 for no limit, and whether
+// the rate adapts to the observed latency.  Must be called before any scan
+// starts.
+void configure (unsigned max_rate, bool adaptive);
+
+// Puts the calling thread into the idle I/O scheduling class.  Threads
+// started by it afterwards inherit the class.  Returns false and sets errno
+// on failure.
+bool set_idle_priority ();
+
+// Blocks until the next entry may be processed.
+void acquire ();
+
+// Reports how long getting the metadata of an entry took.
+void record (Clock::duration latency);
+
+// Returns the current limit in entries per second or 0 if the rate is not
+// limited.
+f64 rate ();
+}
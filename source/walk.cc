@@ -0,0 +1,203 @@
+#include "walk.hh"
+#include "extents.hh"
+#include "throttle.hh"
+#include <fcntl.h>
+#include <unistd.h>
+
+DIR *
+open_dir (int parent_fd, const char *name, bool follow)
+{
+  const int fd = ::openat (parent_fd, name,
+                           (O_RDONLY | O_DIRECTORY | O_CLOEXEC
+                            | (follow ? 0 : O_NOFOLLOW)));
+  if (fd == -1)
+    return nullptr;
+  DIR *const dir = ::fdopendir (fd);
+  if (!dir)
+    ::close (fd);
+  return dir;
+}
+
+bool
+VisitedDirs::enter (const struct stat &sb)
+{
+  std::lock_guard lock (mutex_);
+  return visited_.emplace (sb.st_dev, sb.st_ino).second;
+}
+
+bool
+VisitedDirs::enter (DIR *dir)
+{
+  struct stat sb;
+  return ::fstat (::dirfd (dir), &sb) == -1 || enter (sb);
+}
+
+void
+VisitedDirs::clear ()
+{
+  std::lock_guard lock (mutex_);
+  visited_.clear ();
+}
+
+bool
+links_to_directory (int dir_fd, const char *name)
+{
+  struct stat sb;
+  return ::fstatat (dir_fd, name, &sb, 0) == 0 && S_ISDIR (sb.st_mode);
+}
+
+bool
+read_entry (DIR *dir, bool follow, DirEntry &entry)
+{
+  const struct dirent *de;
+  do
+    {
+      errno = 0;
+      if (!(de = ::readdir (dir)))
+        return false;
+    }
+  while (std::strcmp (de->d_name, ".") == 0
+         || std::strcmp (de->d_name, "..") == 0);
+  entry.name = de->d_name;
+  entry.error = 0;
+  entry.is_link = false;
+  Throttle::acquire ();
+  // Directories do not count towards the size so they only need to be
+  // stat'ed if the file system does not report the entry type.
+  entry.is_directory = de->d_type == DT_DIR;
+  if (entry.is_directory)
+    return true;
+  const Throttle::Clock::time_point start = Throttle::Clock::now ();
+  const int result = ::fstatat (::dirfd (dir), de->d_name, &entry.sb,
+                                AT_SYMLINK_NOFOLLOW);
+  Throttle::record (Throttle::Clock::now () - start);
+  if (result == -1)
+    entry.error = errno;
+  else if (S_ISDIR (entry.sb.st_mode))
+    entry.is_directory = true;
+  else if (follow && S_ISLNK (entry.sb.st_mode)
+           && links_to_directory (::dirfd (dir), de->d_name))
+    entry.is_directory = entry.is_link = true;
+  return true;
+}
+
+ScanStatus
+directory_size_and_file_count (const fs::path &path, u64 &size, u64 &count,
+                               Summary &summary, ScanErrors &errors,
+                               const ScanLimits &limits,
+                               ScanProgress *progress, const ScanHooks *hooks)
+{
+  // How often the progress gets published and the limits get checked
+  constexpr u64 CHECK_INTERVAL = 256;
+  struct Level
+  {
+    DIR *dir;
+    // Length of the path of the parent directory
+    usize parent_length;
+  };
+  // The stack of open directories and the path of the current one live in
+  // an arena that is released at once when the scan is done, the walk itself
+  // does not allocate anything per entry.
+  std::array<std::byte, 4096> buffer;
+  std::pmr::monotonic_buffer_resource arena (buffer.data (), buffer.size ());
+  std::pmr::vector<Level> stack (&arena);
+  std::pmr::string dir_path (path.native (), &arena);
+  DirEntry entry;
+  ScanStatus status = ScanStatus::Complete;
+  u64 visited = 0;
+  VisitedDirs *const follow = hooks ? hooks->follow : nullptr;
+  ExtentMap *const extents = hooks ? hooks->extents : nullptr;
+  size = count = 0;
+  if (std::chrono::steady_clock::now () >= limits.deadline)
+    return ScanStatus::Truncated;
+  // The subtree root itself may be a symlink, see `process_dir'.
+  DIR *const root = open_dir (AT_FDCWD, path.c_str (), true);
+  if (!root)
+    {
+      errors.add (errno);
+      return ScanStatus::Failed;
+    }
+  stack.push_back ({root, dir_path.size ()});
+  while (!stack.empty ())
+    {
+      DIR *const dir = stack.back ().dir;
+      if (!read_entry (dir, follow, entry))
+        {
+          // The rest of the directory is lost but what was read so far still
+          // counts.
+          if (errno)
+            errors.add (errno);
+          dir_path.resize (stack.back ().parent_length);
+          ::closedir (dir);
+          stack.pop_back ();
+          continue;
+        }
+      if (entry.error)
+        {
+          errors.add (entry.error);
+          continue;
+        }
+      const struct stat &sb = entry.sb;
+      if (!entry.is_directory
+          && (S_ISREG (sb.st_mode) || S_ISLNK (sb.st_mode)))
+        {
+          summary.add_file (entry.name, sb);
+          if (extents && extents->checks (sb))
+            extents->add_file (::dirfd (dir), entry.name, sb,
+                               summary.extents);
+          size += sb.st_size;
+          ++count;
+          if (hooks && hooks->file && S_ISREG (sb.st_mode))
+            hooks->file (fs::path (dir_path) / entry.name, sb);
+        }
+      else if (entry.is_directory)
+        {
+          // The subtree root is at depth 1 and its entries at depth 2.
+          if (limits.max_depth && stack.size () + 1 > limits.max_depth)
+            status = ScanStatus::Truncated;
+          else if (DIR *const child = open_dir (::dirfd (dir), entry.name,
+                                                entry.is_link))
+            {
+              // Already counted through another link
+              if (follow && !follow->enter (child))
+                ::closedir (child);
+              else
+                {
+                  stack.push_back ({child, dir_path.size ()});
+                  if (dir_path.back () != '/')
+                    dir_path += '/';
+                  dir_path += entry.name;
+                }
+            }
+          else
+            errors.add (errno);
+        }
+      if (++visited % CHECK_INTERVAL == 0)
+        {
+          if (progress)
+            {
+              progress->size = size;
+              progress->file_count = count;
+              progress->entries = visited;
+              if (hooks && hooks->progress)
+                hooks->progress (*progress);
+              if (progress->cancel)
+                {
+                  status = ScanStatus::Truncated;
+                  break;
+                }
+            }
+          if (std::chrono::steady_clock::now () >= limits.deadline)
+            {
+              status = ScanStatus::Truncated;
+              break;
+            }
+        }
+    }
+  for (const Level &level : stack)
+    ::closedir (level.dir);
+  if (progress)
+    progress->entries = visited;
+  summary.shrink ();
+  return status;
+}
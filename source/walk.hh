@@ -0,0 +1,139 @@
+#pragma once
+#include "stdafx.hh"
+#include "summary.hh"
+
+// Limits for sizing a subtree, exceeding them truncates the scan.
+struct ScanLimits
+{
+  // Number of levels below the listed directory that get walked, 0 for no
+  // limit.
+  unsigned max_depth = 0;
+  std::chrono::steady_clock::time_point deadline
+    = std::chrono::steady_clock::time_point::max ();
+};
+
+enum class ScanStatus
+{
+  Complete,
+  // Stopped early, the size and file count are lower bounds
+  Truncated,
+  // The size and file count were estimated from a sample of the subtree
+  Estimated,
+  Failed
+};
+
+// Entries that could not be read while scanning a subtree, they are skipped.
+struct ScanErrors
+{
+  u64 count = 0;
+  // errno of the first one
+  int first = 0;
+
+  void
+  add (int error)
+  {
+    if (count++ == 0)
+      first = error;
+  }
+};
+
+// Shared with a running scan of a subtree.
+struct ScanProgress
+{
+  std::atomic<u64> size = 0;
+  std::atomic<u64> file_count = 0;
+  // Half width of the confidence interval when estimating
+  std::atomic<u64> margin = 0;
+  // Number of directory entries looked at so far
+  std::atomic<u64> entries = 0;
+  // Makes the scan stop early when set
+  std::atomic<bool> cancel = false;
+};
+
+// Hash of an id that is unique per device, like an inode number.
+struct DeviceIdHash
+{
+  usize
+  operator() (const std::pair<dev_t, u64> &id) const
+  {
+    return std::hash<u64> {} (id.second * 0x9e3779b97f4a7c15ULL ^ id.first);
+  }
+};
+
+// Directories entered by walks that follow symlinks, by device and inode, so
+// every directory counts once no matter how many links lead to it and cycles
+// end where they return to a directory already entered.  Shared by all walks
+// of one scan, which may run on different threads.
+class VisitedDirs
+{
+public:
+  // Returns whether the directory has not been entered before and marks it
+  // as entered.  Directories that cannot be stat'ed are always entered.
+  bool enter (const struct stat &sb);
+  bool enter (DIR *dir);
+
+  void clear ();
+
+private:
+  std::mutex mutex_;
+  std::unordered_set<std::pair<dev_t, u64>, DeviceIdHash> visited_;
+};
+
+class ExtentMap;
+
+// Optional callbacks made by the walk on the thread running it.
+struct ScanHooks
+{
+  // Called for every regular file with its full path
+  std::function<void (const fs::path &, const struct stat &)> file;
+  // Called whenever the counters of the progress got published
+  std::function<void (const ScanProgress &)> progress;
+  // Symlinks to directories are followed if set, into directories not
+  // entered before.  Other symlinks still count as files.  The walk does not
+  // check its root, the caller enters it.
+  VisitedDirs *follow = nullptr;
+  // Checks the extents of the files it is interested in into the summary
+  // if set
+  ExtentMap *extents = nullptr;
+};
+
+// Sizing of a whole subtree.  The walk only uses the state passed to it, so
+// any number of walks can run at the same time on different threads.
+// Walks the subtree at `path'.  Entries that cannot be read are skipped and
+// recorded in `errors', the scan only fails if `path' itself cannot be read.
+// The rate of the walk is limited by the process wide `Throttle'.
+ScanStatus directory_size_and_file_count (const fs::path &path, u64 &size,
+                                          u64 &count, Summary &summary,
+                                          ScanErrors &errors,
+                                          const ScanLimits &limits = {},
+                                          ScanProgress *progress = nullptr,
+                                          const ScanHooks *hooks = nullptr);
+
+// An entry of a directory as the walks see it.
+struct DirEntry
+{
+  const char *name;
+  // errno if the entry could not be stat'ed
+  int error;
+  // Also set for followed symlinks to directories, which have `is_link' set
+  bool is_directory;
+  bool is_link;
+  // Only filled in for entries that are not directories
+  struct stat sb;
+};
+
+// Reads the next entry of `dir' other than . and .. and classifies it.  Only
+// entries the file system does not report as directories get stat'ed.
+// Symlinks to directories count as directories if `follow' is set.  Returns
+// false at the end of the directory, with errno set if it could not be read
+// to the end.  The rate is limited by the process wide `Throttle'.
+bool read_entry (DIR *dir, bool follow, DirEntry &entry);
+
+// Returns whether the symlink `name' relative to `dir_fd' points to a
+// directory.
+bool links_to_directory (int dir_fd, const char *name);
+
+// Opens the directory `name' relative to `parent_fd', which may be
+// AT_FDCWD.  Symlinks are only followed if `follow' is set.  Returns null
+// and leaves errno set on failure.
+DIR * open_dir (int parent_fd, const char *name, bool follow);
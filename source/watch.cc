@@ -0,0 +1,136 @@
+#include "watch.hh"
+#include "space_info.hh"
+#include <unistd.h>
+
+namespace Watch
+{
+using Clock = std::chrono::steady_clock;
+
+// Escapes a label value as required by the text format.
+static std::string
+label_value (std::string_view value)
+{
+  std::string result;
+  result.reserve (value.size ());
+  for (const char c : value)
+    switch (c)
+      {
+        case '\\': result += "\\\\"; break;
+        case '"': result += "\\\""; break;
+        case '\n': result += "\\n"; break;
+        default: result += c; break;
+      }
+  return result;
+}
+
+static void
+header (FILE *f, const char *name, const char *help)
+{
+  std::fprintf (f, "# HELP %s %s\n# TYPE %s gauge\n", name, help, name);
+}
+
+static void
+sample (FILE *f, const char *name, const fs::path &path, u64 value)
+{
+  std::fprintf (f, "%s{path=\"%s\"} %" PRIu64 "\n",
+                name, label_value (path.native ()).c_str (), value);
+}
+
+// Writes one metric for the root and each of its subdirectories.
+static void
+directory_metric (FILE *f, const char *name, const char *help,
+                  const fs::path &root, const SpaceInfo &si, u64 root_value,
+                  u64 (*value) (const SpaceInfo::value_type &))
+{
+  header (f, name, help);
+  sample (f, name, root, root_value);
+  for (usize i = 1; i <= si.item_count (); ++i)
+    if (si[i].is_directory)
+      sample (f, name, root / si[i].path, value (si[i]));
+}
+
+static void
+write_metrics (FILE *f, const fs::path &root, const SpaceInfo *si,
+               f64 duration)
+{
+  header (f, "spaceinfo_scan_success",
+          "Whether the last scan could read the root directory.");
+  std::fprintf (f, "spaceinfo_scan_success %d\n", si != nullptr);
+  header (f, "spaceinfo_scan_duration_seconds",
+          "How long the last scan took.");
+  std::fprintf (f, "spaceinfo_scan_duration_seconds %.3f\n", duration);
+  header (f, "spaceinfo_scan_timestamp_seconds",
+          "When the last scan finished.");
+  std::fprintf (f, "spaceinfo_scan_timestamp_seconds %lld\n",
+                static_cast<long long> (std::time (nullptr)));
+  if (si == nullptr)
+    return;
+  directory_metric (f, "spaceinfo_directory_size_bytes",
+                    "Apparent size of the files below the directory.",
+                    root, *si, si->total (),
+                    [](const SpaceInfo::value_type &item) -> u64 {
+                      return item.size;
+                    });
+  directory_metric (f, "spaceinfo_directory_files",
+                    "Number of files below the directory.",
+                    root, *si, si->total_file_count (),
+                    [](const SpaceInfo::value_type &item) {
+                      return item.file_count;
+                    });
+  directory_metric (f, "spaceinfo_directory_unreadable_entries",
+                    "Entries below the directory that could not be read.",
+                    root, *si, si->unreadable_count (),
+                    [](const SpaceInfo::value_type &item) {
+                      return item.unreadable;
+                    });
+}
+
+// Writes the metrics to a temporary file next to `output' and renames it so
+// the collector never sees a partially written file.
+static bool
+publish (const char *output, const fs::path &root, const SpaceInfo *si,
+         f64 duration)
+{
+  const std::string temp = (std::string (output) + ".tmp."
+                            + std::to_string (::getpid ()));
+  FILE *const f = std::fopen (temp.c_str (), "w");
+  if (f == nullptr)
+    return false;
+  write_metrics (f, root, si, duration);
+  const bool ok = !std::ferror (f);
+  if (std::fclose (f) != 0 || !ok
+      || std::rename (temp.c_str (), output) != 0)
+    {
+      const int error = errno;
+      std::remove (temp.c_str ());
+      errno = error;
+      return false;
+    }
+  return true;
+}
+
+int
+run (const fs::path &root, unsigned interval, const char *output)
+{
+  for (;;)
+    {
+      const Clock::time_point start = Clock::now ();
+      // Only the listing of the root is kept between cycles so the memory
+      // used stays the same no matter how often the tree is scanned.
+      G_dirs.clear ();
+      const SpaceInfo *const si = process_dir (root);
+      finish_scans ();
+      if (si == nullptr)
+        std::fprintf (stderr, "%s: %s\n", root.c_str (),
+                      G_error.message ().c_str ());
+      const f64 duration
+        = std::chrono::duration<f64> (Clock::now () - start).count ();
+      if (!publish (output, root, si, duration))
+        {
+          std::fprintf (stderr, "%s: %s\n", output, std::strerror (errno));
+          return 1;
+        }
+      std::this_thread::sleep_until (start + std::chrono::seconds (interval));
+    }
+}
+}
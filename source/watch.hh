@@ -0,0 +1,13 @@
+#pragma once
+#include "stdafx.hh"
+
+// Headless mode for monitoring: the directory is rescanned on a schedule and
+// the sizes of its subdirectories are written as Prometheus metrics in the
+// text format, for the textfile collector of node_exporter.
+namespace Watch
+{
+// Rescans `root' every `interval' seconds and replaces the file at `output'
+// with the new metrics after each scan.  Only returns if the metrics cannot
+// be written.
+int run (const fs::path &root, unsigned interval, const char *output);
+}
@@ -0,0 +1,184 @@
+// Listing the members of zip and tar files built here byte by byte.
+#include "check.hh"
+#include "archive.hh"
+
+static void
+put_le (std::string &out, u64 value, usize bytes)
+{
+  for (usize i = 0; i < bytes; ++i)
+    out += static_cast<char> (value >> (i * 8));
+}
+
+// Appends a central directory entry, the local headers are never read.
+static void
+zip_entry (std::string &directory, std::string_view name, u32 compressed,
+           u32 uncompressed, std::string_view extra = {})
+{
+  put_le (directory, 0x02014b50, 4);
+  put_le (directory, 0x031e, 2);
+  put_le (directory, 20, 2);
+  put_le (directory, 0, 2);
+  put_le (directory, 8, 2);
+  // 2020-01-01 12:00
+  put_le (directory, 12 << 11, 2);
+  put_le (directory, (40 << 9) | (1 << 5) | 1, 2);
+  put_le (directory, 0, 4);
+  put_le (directory, compressed, 4);
+  put_le (directory, uncompressed, 4);
+  put_le (directory, name.size (), 2);
+  put_le (directory, extra.size (), 2);
+  put_le (directory, 0, 2);
+  put_le (directory, 0, 2);
+  put_le (directory, 0, 2);
+  const u32 mode = name.ends_with ('/') ? 040755 : 0100644;
+  put_le (directory, mode << 16, 4);
+  put_le (directory, 0, 4);
+  directory += name;
+  directory += extra;
+}
+
+static std::string
+zip_file (u64 entries, std::string_view directory)
+{
+  // Stands in for the local headers and the data
+  std::string zip (64, '\0');
+  zip += directory;
+  put_le (zip, 0x06054b50, 4);
+  put_le (zip, 0, 4);
+  put_le (zip, entries, 2);
+  put_le (zip, entries, 2);
+  put_le (zip, directory.size (), 4);
+  put_le (zip, 64, 4);
+  put_le (zip, 0, 2);
+  return zip;
+}
+
+static void
+tar_member (std::string &tar, std::string_view name, std::string_view data,
+            char type = '0')
+{
+  std::string header (512, '\0');
+  name.copy (header.data (), 100);
+  std::snprintf (&header[100], 8, "%07o", 0644);
+  std::snprintf (&header[108], 8, "%07o", 1000);
+  std::snprintf (&header[116], 8, "%07o", 100);
+  std::snprintf (&header[124], 12, "%011zo", data.size ());
+  std::snprintf (&header[136], 12, "%011o", 1'600'000'000);
+  header[156] = type;
+  std::memcpy (&header[257], "ustar\0" "00", 8);
+  std::fill (&header[148], &header[156], ' ');
+  unsigned sum = 0;
+  for (const char c : header)
+    sum += static_cast<u8> (c);
+  std::snprintf (&header[148], 8, "%06o", sum);
+  tar += header;
+  tar += data;
+  tar.append ((512 - data.size () % 512) % 512, '\0');
+}
+
+// Returns the items of the listing as "name size count" strings sorted by
+// name, or "error" if it cannot be read.
+static std::vector<std::string>
+listing (const fs::path &path)
+{
+  SpaceInfo *const si = Archive::load (path);
+  if (!si)
+    return {"error"};
+  si->sort (SortKey::Name);
+  std::vector<std::string> result;
+  for (usize i = 1; i <= si->item_count (); ++i)
+    {
+      const SpaceInfo::value_type &item = (*si)[i];
+      result.push_back (item.path.native () + (item.is_directory ? "/ " : " ")
+                        + std::to_string (item.size) + " "
+                        + std::to_string (item.file_count));
+    }
+  return result;
+}
+
+using Listing = std::vector<std::string>;
+
+static void
+zip (const TempDir &dir)
+{
+  std::string directory;
+  zip_entry (directory, "docs/", 0, 0);
+  zip_entry (directory, "docs/readme.txt", 120, 400);
+  zip_entry (directory, "./docs/../../escape", 1, 1);
+  // The real sizes are in the zip64 extra field, compressed after
+  // uncompressed
+  std::string zip64;
+  put_le (zip64, 0x0001, 2);
+  put_le (zip64, 16, 2);
+  put_le (zip64, 6'000'000'000, 8);
+  put_le (zip64, 5'000'000'000, 8);
+  zip_entry (directory, "top.bin", 0xffffffff, 0xffffffff, zip64);
+  // A zip64 field longer than the extra data is ignored
+  std::string cut;
+  put_le (cut, 0x0001, 2);
+  put_le (cut, 16, 2);
+  put_le (cut, 7, 4);
+  zip_entry (directory, "cut.bin", 0xffffffff, 10, cut);
+  const fs::path path = dir.file ("test.zip", zip_file (5, directory));
+
+  CHECK (listing (path)
+         == (Listing {"cut.bin 4294967295 1", "docs/ 120 1",
+                      "top.bin 5000000000 1"}));
+  CHECK (listing (path / "docs") == (Listing {"readme.txt 120 1"}));
+  CHECK (listing (path / "missing") == Listing {"error"});
+
+  // The directory runs past the end record
+  const fs::path broken = dir.file ("broken.zip", zip_file (5, directory)
+                                                    .substr (0, 100));
+  CHECK (listing (broken) == Listing {"error"});
+  CHECK (listing (dir.file ("empty.zip", "")) == Listing {"error"});
+}
+
+static void
+tar (const TempDir &dir)
+{
+  std::string tar;
+  tar_member (tar, "dir/", "", '5');
+  tar_member (tar, "dir/a.txt", std::string (700, 'a'));
+  tar_member (tar, "dir/sub/b", "b");
+  tar_member (tar, "top", "");
+  tar_member (tar, "link", "", '2');
+  // Names too long for the header, from a pax header and a GNU long name
+  const std::string pax_path = "pax/" + std::string (120, 'p');
+  const std::string record = " path=" + pax_path + "\n";
+  std::string pax = std::to_string (record.size () + 3) + record;
+  tar_member (tar, "PaxHeader", pax, 'x');
+  tar_member (tar, "ignored", "ccc");
+  tar_member (tar, "././@LongLink", "gnu/" + std::string (110, 'g'), 'L');
+  tar_member (tar, "ignored", "dddd");
+  tar.append (1024, '\0');
+  const fs::path path = dir.file ("test.tar", tar);
+
+  CHECK (listing (path)
+         == (Listing {"dir/ 701 2", "gnu/ 4 1", "link 0 1", "pax/ 3 1",
+                      "top 0 1"}));
+  CHECK (listing (path / "dir") == (Listing {"a.txt 700 1", "sub/ 1 1"}));
+  CHECK (listing (path / "pax")
+         == (Listing {std::string (120, 'p') + " 3 1"}));
+
+  // Without the end marker the members are still listed
+  const fs::path unterminated = dir.file ("unterminated.tar",
+                                          tar.substr (0, tar.size () - 1024));
+  CHECK (listing (unterminated).size () == 5);
+
+  std::string corrupt = tar;
+  corrupt[0] ^= 1;
+  CHECK (listing (dir.file ("corrupt.tar", corrupt)) == Listing {"error"});
+}
+
+int
+main ()
+{
+  TempDir dir;
+  CHECK (Archive::is_archive ("a.ZIP"));
+  CHECK (Archive::is_archive ("a.tar.gz"));
+  CHECK (!Archive::is_archive ("a.txt"));
+  zip (dir);
+  tar (dir);
+  return finish ("archive");
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include "stdafx.hh"
+#include <fstream>
+#include <unistd.h>
+
+// Checks for the test programs.  A failed check prints where it failed and
+// the program carries on, `finish' makes it exit with an error then.
+inline unsigned G_checks = 0;
+inline unsigned G_failures = 0;
+
+#define CHECK(condition)                                                    \
+  do                                                                        \
+    {                                                                       \
+      ++G_checks;                                                           \
+      if (!(condition))                                                     \
+        {                                                                   \
+          ++G_failures;                                                     \
+          std::fprintf (stderr, "%s:%d: check failed: %s\n", __FILE__,      \
+                        __LINE__, #condition);                              \
+        }                                                                   \
+    }                                                                       \
+  while (false)
+
+#define CHECK_EQ(a, b)                                                      \
+  do                                                                        \
+    {                                                                       \
+      ++G_checks;                                                           \
+      if (!((a) == (b)))                                                    \
+        {                                                                   \
+          ++G_failures;                                                     \
+          std::fprintf (stderr, "%s:%d: check failed: %s == %s\n",          \
+                        __FILE__, __LINE__, #a, #b);                        \
+        }                                                                   \
+    }                                                                       \
+  while (false)
+
+inline int
+finish (const char *name)
+{
+  std::printf ("%s: %u checks, %u failed\n", name, G_checks, G_failures);
+  return G_failures ? 1 : 0;
+}
+
+// A directory that is created empty and removed with everything in it when
+// the test is done.
+class TempDir
+{
+public:
+  TempDir ()
+  {
+    char name[] = "/tmp/spaceinfo-test-XXXXXX";
+    if (!::mkdtemp (name))
+      {
+        std::perror ("mkdtemp");
+        std::exit (1);
+      }
+    path_ = name;
+  }
+
+  ~TempDir ()
+  {
+    std::error_code error;
+    fs::remove_all (path_, error);
+  }
+
+  TempDir (const TempDir &) = delete;
+  TempDir & operator= (const TempDir &) = delete;
+
+  const fs::path & path () const { return path_; }
+
+  // Writes `size' bytes to the file at `rel', creating the directories on
+  // the way.
+  fs::path
+  file (const fs::path &rel, usize size) const
+  { return file (rel, std::string (size, 'x')); }
+
+  fs::path
+  file (const fs::path &rel, std::string_view data) const
+  {
+    const fs::path path = path_ / rel;
+    fs::create_directories (path.parent_path ());
+    std::ofstream out (path, std::ios::binary | std::ios::trunc);
+    out.write (data.data (), data.size ());
+    return path;
+  }
+
+private:
+  fs::path path_;
+};
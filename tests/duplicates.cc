@@ -0,0 +1,88 @@
+// Finding identical files among the recorded ones, in a temporary tree.
+#include "check.hh"
+#include "duplicates.hh"
+#include "options.hh"
+
+// Records every regular file below `root'.
+static void
+record_tree (const fs::path &root)
+{
+  struct stat sb;
+  for (const fs::directory_entry &entry :
+       fs::recursive_directory_iterator (root))
+    if (::lstat (entry.path ().c_str (), &sb) == 0 && S_ISREG (sb.st_mode))
+      Duplicates::record (entry.path (), sb);
+}
+
+// Returns the groups as lists of paths relative to `root'.
+static std::vector<std::vector<std::string>>
+groups (const fs::path &root, const fs::path &under)
+{
+  std::vector<std::vector<std::string>> result;
+  for (const Duplicates::Group &group : Duplicates::find (under))
+    {
+      std::vector<std::string> &paths = result.emplace_back ();
+      for (const fs::path &path : group.paths)
+        paths.push_back (path.lexically_relative (root).native ());
+    }
+  return result;
+}
+
+using Groups = std::vector<std::vector<std::string>>;
+
+int
+main ()
+{
+  Options::duplicates_min_size = 1;
+  TempDir tree;
+  const fs::path root = tree.path ();
+  const std::string big (300'000, 'a');
+  tree.file ("a/1", big);
+  tree.file ("b/2", big);
+  const std::string other (200'000, 'a');
+  tree.file ("a/3", other);
+  tree.file ("b/4", other);
+  // Same size and the same first and last blocks, but not the same
+  std::string middle = other;
+  middle[100'000] = 'b';
+  tree.file ("b/5", middle);
+  // Below the minimum size
+  tree.file ("a/small", 100);
+  tree.file ("b/small", 100);
+  // A hard link is the same file, not a copy
+  fs::create_hard_link (root / "a/1", root / "a/link");
+  record_tree (root);
+
+  // The biggest savings come first, the hard link is recorded under either
+  // of its names
+  Groups found = groups (root, root);
+  CHECK_EQ (found.size (), 2U);
+  CHECK (!found.empty ()
+         && (found[0] == (std::vector<std::string> {"a/1", "b/2"})
+             || found[0] == (std::vector<std::string> {"a/link", "b/2"})));
+  CHECK (found.size () < 2
+         || found[1] == (std::vector<std::string> {"a/3", "b/4"}));
+  CHECK (groups (root, root / "a").empty ());
+
+  // Groups of more files than are kept open at once
+  for (int i = 0; i < 40; ++i)
+    tree.file ("many/" + std::to_string (100 + i), std::string (5000, 'm'));
+  tree.file ("many/other", std::string (5000, 'n'));
+  record_tree (root / "many");
+  found = groups (root, root / "many");
+  CHECK_EQ (found.size (), 1U);
+  CHECK (!found.empty () && found[0].size () == 40);
+
+  // Files that went away are dropped, the rest are kept
+  fs::remove (root / "b/2");
+  Duplicates::forget (root / "b", true);
+  CHECK (groups (root, root / "a").empty ());
+  CHECK_EQ (groups (root, root).size (), 2U);
+  Duplicates::forget (root / "many");
+  CHECK (groups (root, root) == (Groups {{"a/3", "b/4"}}));
+
+  // A file changed since the scan no longer matches
+  tree.file ("b/4", other.substr (0, 199'999) + "c");
+  CHECK (groups (root, root).empty ());
+  return finish ("duplicates");
+}
@@ -0,0 +1,81 @@
+// Encoding of varints and strings, and reading malformed data.
+#include "check.hh"
+#include "encoding.hh"
+
+static void
+varints ()
+{
+  constexpr std::array<u64, 8> values = {
+    0, 1, 127, 128, 300, 1ULL << 32, 1ULL << 63,
+    std::numeric_limits<u64>::max ()
+  };
+  constexpr std::array<s64, 6> signed_values = {
+    0, -1, 1, -64, std::numeric_limits<s64>::min (),
+    std::numeric_limits<s64>::max ()
+  };
+  Encoder enc;
+  for (const u64 v : values)
+    enc.uint (v);
+  for (const s64 v : signed_values)
+    enc.sint (v);
+  enc.string ("name");
+  enc.string ("");
+
+  Decoder dec (enc.data ());
+  for (const u64 v : values)
+    CHECK_EQ (dec.uint (), v);
+  for (const s64 v : signed_values)
+    CHECK_EQ (dec.sint (), v);
+  CHECK (dec.string () == "name");
+  CHECK (dec.string ().empty ());
+  CHECK (dec.ok ());
+  CHECK (dec.at_end ());
+
+  // Small values take one byte
+  Encoder small;
+  small.uint (127);
+  CHECK_EQ (small.size (), 1U);
+  small.uint (128);
+  CHECK_EQ (small.size (), 3U);
+}
+
+static void
+malformed_varints ()
+{
+  // Cut off in the middle of a varint
+  Decoder cut ("\x80\x80");
+  CHECK_EQ (cut.uint (), 0U);
+  CHECK (!cut.ok ());
+  // Reads after an error keep failing
+  CHECK_EQ (cut.uint (), 0U);
+
+  // More than 64 bits
+  Decoder long_varint ("\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\x01");
+  long_varint.uint ();
+  CHECK (!long_varint.ok ());
+
+  // A string longer than the data
+  Encoder enc;
+  enc.uint (10);
+  enc.raw ("abc");
+  Decoder string (enc.data ());
+  CHECK (string.string ().empty ());
+  CHECK (!string.ok ());
+
+  Encoder bounded;
+  bounded.uint (41);
+  bounded.uint (42);
+  Decoder dec (bounded.data ());
+  CHECK_EQ (dec.uint (41), 41U);
+  CHECK (dec.ok ());
+  CHECK_EQ (dec.uint (41), 0U);
+  CHECK (!dec.ok ());
+}
+
+int
+main ()
+{
+  varints ();
+  malformed_varints ();
+  return finish ("encoding");
+}
@@ -0,0 +1,110 @@
+// Extent aware sizes of files in a temporary tree, with a reflinked copy
+// where the file system supports it.
+#include "check.hh"
+#include "encoding.hh"
+#include "extents.hh"
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+
+// Returns the extents of `path' as seen by `map', or nothing if they cannot
+// be read.
+static std::optional<ExtentUsage>
+usage_of (ExtentMap &map, const fs::path &path)
+{
+  struct stat sb;
+  ExtentUsage usage;
+  if (::stat (path.c_str (), &sb) == -1
+      || !map.add_file (AT_FDCWD, path.c_str (), sb, usage))
+    return std::nullopt;
+  return usage;
+}
+
+// Makes `to' a reflinked copy of `from', returns false if the file system
+// cannot do that.
+static bool
+clone (const fs::path &from, const fs::path &to)
+{
+  const int in = ::open (from.c_str (), O_RDONLY);
+  const int out = ::open (to.c_str (), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  const bool cloned = (in != -1 && out != -1
+                       && ::ioctl (out, FICLONE, in) == 0);
+  ::close (in);
+  ::close (out);
+  if (!cloned)
+    fs::remove (to);
+  return cloned;
+}
+
+static bool
+same (const ExtentUsage &a, const ExtentUsage &b)
+{
+  return (a.files == b.files && a.exclusive == b.exclusive
+          && a.shared == b.shared && a.allocated == b.allocated);
+}
+
+int
+main ()
+{
+  constexpr u64 MIB = 1 << 20;
+  TempDir tree;
+  const fs::path root = tree.path ();
+  tree.file ("data", MIB);
+  tree.file ("small", 100);
+  // Size without any extents
+  const fs::path sparse = tree.file ("sparse", 0);
+  fs::resize_file (sparse, 8 * MIB);
+
+  ExtentMap map (4096);
+  struct stat sb;
+  ::stat ((root / "small").c_str (), &sb);
+  CHECK (!map.checks (sb));
+  ::stat ((root / "data").c_str (), &sb);
+  CHECK (map.checks (sb));
+  ::stat (root.c_str (), &sb);
+  CHECK (!map.checks (sb));
+
+  // The encoding keeps the usage whether the file system has extents or not
+  Summary summary;
+  summary.extents = {2, 300, 4000, 2300};
+  Encoder enc;
+  summary.encode (enc);
+  Decoder dec (enc.data ());
+  Summary decoded;
+  CHECK (decoded.decode (dec));
+  CHECK (same (decoded.extents, summary.extents));
+
+  const std::optional<ExtentUsage> data = usage_of (map, root / "data");
+  if (!data)
+    {
+      std::printf ("extents: no FIEMAP here, skipping the file checks\n");
+      return finish ("extents");
+    }
+  CHECK (same (*data, {1, MIB, 0, MIB}));
+  const std::optional<ExtentUsage> holes = usage_of (map, sparse);
+  CHECK (holes && same (*holes, {1, 0, 0, 0}));
+
+  // A walk with the map sums up the files big enough to get checked
+  u64 size = 0, count = 0;
+  Summary walked;
+  ScanErrors errors;
+  ScanHooks hooks;
+  hooks.extents = &map;
+  CHECK (directory_size_and_file_count (root, size, count, walked, errors,
+                                        {}, nullptr, &hooks)
+         == ScanStatus::Complete);
+  CHECK (same (walked.extents, {2, MIB, 0, MIB}));
+
+  // Both copies share the extents, which are allocated once
+  if (clone (root / "data", root / "copy"))
+    {
+      ExtentMap fresh (4096);
+      const std::optional<ExtentUsage> first = usage_of (fresh, root / "data");
+      const std::optional<ExtentUsage> copy = usage_of (fresh, root / "copy");
+      CHECK (first && same (*first, {1, 0, MIB, MIB}));
+      CHECK (copy && same (*copy, {1, 0, MIB, 0}));
+    }
+  else
+    std::printf ("extents: no reflinks here, skipping the shared checks\n");
+  return finish ("extents");
+}
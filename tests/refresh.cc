@@ -0,0 +1,73 @@
+// Refreshing single entries of scanned directories, in a temporary tree.
+#include "check.hh"
+#include "duplicates.hh"
+#include "options.hh"
+#include "space_info.hh"
+
+// Returns the size of `name' in `si', or -1 if it is not there.
+static s64
+size_of (const SpaceInfo &si, const fs::path &name)
+{
+  const usize idx = si.index_of (name);
+  return idx ? static_cast<s64> (si[idx].size) : -1;
+}
+
+int
+main ()
+{
+  Options::find_duplicates = true;
+  Options::duplicates_min_size = 1;
+  TempDir tree;
+  const fs::path root = tree.path ();
+  const std::string big (300'000, 'a');
+  tree.file ("keep", big);
+  tree.file ("entry/inner", 10);
+  tree.file ("sub/deep/x", 100);
+  tree.file ("sub/y", 20);
+  tree.file ("gone", 5);
+
+  SpaceInfo *const si = process_dir (root);
+  finish_scans ();
+  CHECK_EQ (si->total (), 300'000U + 10 + 100 + 20 + 5);
+  CHECK_EQ (si->total_file_count (), 5U);
+  SpaceInfo *const sub = process_dir (root / "sub");
+  finish_scans ();
+  CHECK_EQ (sub->total (), 120U);
+
+  // A file that grew, the change goes to every cached ancestor
+  tree.file ("sub/y", 70);
+  CHECK (refresh_entry (root / "sub", "y"));
+  finish_scans ();
+  CHECK_EQ (size_of (*sub, "y"), 70);
+  CHECK_EQ (sub->total (), 170U);
+  CHECK_EQ (size_of (*si, "sub"), 170);
+  CHECK_EQ (si->total (), 300'000U + 10 + 170 + 5);
+
+  // A directory gets scanned again
+  tree.file ("sub/deep/z", 30);
+  CHECK (refresh_entry (root / "sub", "deep"));
+  finish_scans ();
+  CHECK_EQ (size_of (*sub, "deep"), 130);
+  CHECK_EQ (size_of (*si, "sub"), 200);
+  CHECK_EQ (si->total_file_count (), 6U);
+
+  // A directory replaced by a file, which is a duplicate now
+  fs::remove_all (root / "entry");
+  tree.file ("entry", big);
+  CHECK (refresh_entry (root, "entry"));
+  finish_scans ();
+  CHECK_EQ (size_of (*si, "entry"), 300'000);
+  CHECK (!(*si)[si->index_of ("entry")].is_directory);
+  CHECK_EQ (si->total (), 600'000U + 200 + 5);
+  CHECK_EQ (Duplicates::find (root).size (), 1U);
+
+  // An entry that went away is removed
+  fs::remove (root / "gone");
+  CHECK (refresh_entry (root, "gone"));
+  CHECK_EQ (size_of (*si, "gone"), -1);
+  CHECK_EQ (si->total (), 600'000U + 200);
+  CHECK (!refresh_entry (root, "gone"));
+  CHECK (!refresh_entry (root / "missing", "x"));
+
+  return finish ("refresh");
+}
@@ -0,0 +1,74 @@
+// Removing files and trees in the background, in a temporary tree.
+#include "check.hh"
+#include "remove.hh"
+#include <sys/resource.h>
+
+// Removes `path' and waits for the result.
+static Remove::Result
+remove_and_wait (const fs::path &path)
+{
+  Remove::start (path);
+  std::vector<Remove::Result> results;
+  while ((results = Remove::finished ()).empty ())
+    std::this_thread::sleep_for (std::chrono::milliseconds (1));
+  return results.front ();
+}
+
+int
+main ()
+{
+  TempDir tree;
+  const fs::path root = tree.path ();
+
+  tree.file ("file", 123);
+  Remove::Result result = remove_and_wait (root / "file");
+  CHECK (!result.error);
+  CHECK_EQ (result.size, 123U);
+  CHECK_EQ (result.file_count, 1U);
+  CHECK (!fs::exists (root / "file"));
+
+  // Deeper than there are descriptors to hold a directory open per level
+  std::string deep = "tree";
+  for (int i = 0; i < 200; ++i)
+    deep += "/d";
+  tree.file (deep + "/leaf", 100);
+  for (int i = 0; i < 20; ++i)
+    tree.file ("tree/wide" + std::to_string (i) + "/f", 10);
+  // Only the last link to the data frees it
+  tree.file ("tree/linked", 1000);
+  fs::create_hard_link (root / "tree/linked", root / "outside");
+  // A symlink is removed, not followed, and its size is that of the target
+  // name
+  tree.file ("kept/data", 50);
+  fs::create_directory_symlink ("../kept", root / "tree/link");
+  rlimit limit;
+  ::getrlimit (RLIMIT_NOFILE, &limit);
+  const rlimit low {40, limit.rlim_max};
+  ::setrlimit (RLIMIT_NOFILE, &low);
+  result = remove_and_wait (root / "tree");
+  ::setrlimit (RLIMIT_NOFILE, &limit);
+  CHECK (!result.error);
+  CHECK_EQ (result.size, 300U + 7);
+  CHECK_EQ (result.file_count, 23U);
+  CHECK (!fs::exists (root / "tree"));
+  CHECK (fs::exists (root / "outside"));
+  CHECK (fs::exists (root / "kept/data"));
+
+  // What cannot be removed is left and reported
+  tree.file ("locked/sub/a", 10);
+  tree.file ("locked/b", 20);
+  fs::permissions (root / "locked/sub", fs::perms::owner_read
+                                          | fs::perms::owner_exec);
+  if (::geteuid () != 0)
+    {
+      result = remove_and_wait (root / "locked");
+      CHECK (result.error == std::errc::permission_denied);
+      CHECK_EQ (result.size, 20U);
+      CHECK (fs::exists (root / "locked/sub/a"));
+    }
+  fs::permissions (root / "locked/sub", fs::perms::owner_all);
+
+  CHECK (!Remove::busy ());
+  Remove::shutdown ();
+  return finish ("remove");
+}
@@ -0,0 +1,88 @@
+// Scans following symlinks to directories, in a temporary tree with links
+// that lead back up, to the same directory twice and out of the tree.
+#include "check.hh"
+#include "scan.hh"
+
+// Returns "size count" of the scan of `root', and the names of the
+// directories it kept.
+static std::pair<std::string, std::vector<std::string>>
+scan (const fs::path &root, bool follow)
+{
+  Scan::Config config;
+  config.tree_depth = 0;
+  config.follow_symlinks = follow;
+  Scan::Handle scan (root, config);
+  if (scan.run () != ScanStatus::Complete)
+    return {"error", {}};
+  std::vector<std::string> dirs;
+  scan.for_each ([&](const fs::path &path, const Scan::Node &, unsigned) {
+    dirs.push_back (path.lexically_relative (root).native ());
+    return true;
+  });
+  std::sort (dirs.begin (), dirs.end ());
+  return {std::to_string (scan.root ().size) + " "
+            + std::to_string (scan.root ().file_count),
+          dirs};
+}
+
+// Returns "size count" of the walk of `root'.
+static std::string
+walk (const fs::path &root, bool follow)
+{
+  u64 size = 0, count = 0;
+  Summary summary;
+  ScanErrors errors;
+  VisitedDirs visited;
+  ScanHooks hooks;
+  if (follow)
+    {
+      struct stat sb;
+      ::stat (root.c_str (), &sb);
+      visited.enter (sb);
+      hooks.follow = &visited;
+    }
+  if (directory_size_and_file_count (root, size, count, summary, errors, {},
+                                     nullptr, &hooks)
+      != ScanStatus::Complete)
+    return "error";
+  return std::to_string (size) + " " + std::to_string (count);
+}
+
+using Dirs = std::vector<std::string>;
+
+int
+main ()
+{
+  TempDir tree;
+  const fs::path root = tree.path () / "root";
+  tree.file ("root/a/b/f", 1000);
+  tree.file ("out/g", 50);
+  fs::create_directory_symlink ("../..", root / "a/b/loop");
+  fs::create_directory_symlink ("a", root / "alias");
+  fs::create_directory_symlink ("../out", root / "ext");
+  fs::create_symlink ("a/b/f", root / "file_link");
+  fs::create_symlink ("missing", root / "dangling");
+
+  // Without following, every link counts as a file the size of its target
+  // name
+  const u64 links = 5 + 1 + 6 + 5 + 7;
+  const std::string unfollowed = std::to_string (1000 + links) + " 6";
+  CHECK (scan (root, false)
+         == (std::pair {unfollowed, Dirs {".", "a", "a/b"}}));
+  CHECK_EQ (walk (root, false), unfollowed);
+
+  // Following, the directories each count once and the link out of the tree
+  // adds what it leads to.  Links to files still count as files.
+  const std::string followed = std::to_string (1000 + 50 + 5 + 7) + " 4";
+  // The directory is kept under whichever of its names comes first
+  const auto [totals, dirs] = scan (root, true);
+  CHECK_EQ (totals, followed);
+  CHECK (dirs == (Dirs {".", "a", "a/b", "ext"})
+         || dirs == (Dirs {".", "alias", "alias/b", "ext"}));
+  CHECK_EQ (walk (root, true), followed);
+
+  // Entering the tree through a link counts it the same
+  fs::create_directory_symlink ("root", tree.path () / "via");
+  CHECK_EQ (walk (tree.path () / "via", true), followed);
+  return finish ("scan");
+}
@@ -0,0 +1,90 @@
+// Snapshots written in full and against a base, and reads through a chain
+// of them.
+#include "check.hh"
+#include "snapshot.hh"
+
+// Scans `root' and writes the snapshot, against `base' if given.
+static bool
+write (const fs::path &root, const fs::path &file, const fs::path &base = {})
+{
+  Scan::Config config;
+  config.tree_depth = 0;
+  config.keep_files = true;
+  Scan::Handle scan (root, config);
+  return (scan.run () == ScanStatus::Complete
+          && Snapshot::write (file, scan, base));
+}
+
+// Returns the listing as "name size count" strings, or "error" if it cannot
+// be read.
+static std::vector<std::string>
+listing (const fs::path &file, const fs::path &path)
+{
+  std::vector<Snapshot::Entry> entries;
+  if (!Snapshot::read (file, path, entries))
+    return {"error"};
+  std::vector<std::string> result;
+  for (const Snapshot::Entry &e : entries)
+    result.push_back (e.name + (e.is_directory ? "/ " : " ")
+                      + std::to_string (e.size) + " "
+                      + std::to_string (e.file_count));
+  return result;
+}
+
+using Listing = std::vector<std::string>;
+
+int
+main ()
+{
+  TempDir tree;
+  TempDir out;
+  const fs::path root = tree.path ();
+  tree.file ("a", 100);
+  tree.file ("sub/b", 200);
+  tree.file ("sub/c", 300);
+  tree.file ("same/d", 10);
+  tree.file ("gone/e", 20);
+
+  const fs::path full = out.path () / "full";
+  CHECK (write (root, full));
+  CHECK (Snapshot::root (full) == root);
+  CHECK (listing (full, root)
+         == (Listing {"a 100 1", "gone/ 20 1", "same/ 10 1", "sub/ 500 2"}));
+  CHECK (listing (full, root / "sub") == (Listing {"b 200 1", "c 300 1"}));
+  CHECK (Snapshot::contains (full, root / "gone"));
+  CHECK (!Snapshot::contains (full, root / "missing"));
+  CHECK (listing (full, root / "missing") == Listing {"error"});
+  CHECK (listing (full, "/elsewhere") == Listing {"error"});
+
+  // Only the changed directories get pages in the delta
+  fs::remove (root / "sub/b");
+  tree.file ("sub/f", 50);
+  tree.file ("a", 150);
+  fs::remove_all (root / "gone");
+  const fs::path delta = out.path () / "delta";
+  CHECK (write (root, delta, full));
+  CHECK (fs::file_size (delta) < fs::file_size (full));
+  CHECK (listing (delta, root)
+         == (Listing {"a 150 1", "same/ 10 1", "sub/ 350 2"}));
+  CHECK (listing (delta, root / "sub") == (Listing {"c 300 1", "f 50 1"}));
+  CHECK (listing (delta, root / "same") == (Listing {"d 10 1"}));
+  CHECK (!Snapshot::contains (delta, root / "gone"));
+  CHECK (listing (delta, root / "gone") == Listing {"error"});
+  // The base still has the old state
+  CHECK (listing (full, root / "sub") == (Listing {"b 200 1", "c 300 1"}));
+
+  // A delta against a delta reads through both to the full snapshot
+  tree.file ("sub/deeper/g", 5);
+  const fs::path chained = out.path () / "chained";
+  CHECK (write (root, chained, delta));
+  CHECK (listing (chained, root / "sub")
+         == (Listing {"c 300 1", "deeper/ 5 1", "f 50 1"}));
+  CHECK (listing (chained, root / "sub/deeper") == (Listing {"g 5 1"}));
+  CHECK (listing (chained, root / "same") == (Listing {"d 10 1"}));
+  CHECK (listing (chained, root)
+         == (Listing {"a 150 1", "same/ 10 1", "sub/ 355 3"}));
+  CHECK (Snapshot::contains (chained, root / "same"));
+  CHECK (!Snapshot::contains (chained, root / "gone"));
+
+  return finish ("snapshot");
+}
@@ -0,0 +1,129 @@
+// The sorted orders of `SpaceInfo' while items get added, changed and
+// removed.
+#include "check.hh"
+#include "space_info.hh"
+
+constexpr std::array<SortKey, 4> KEYS = {SortKey::Size, SortKey::Name,
+                                         SortKey::FileCount,
+                                         SortKey::Modified};
+
+// Whether `a' may come before `b' when sorting by `key'.
+static bool
+in_order (SortKey key, const SpaceInfo::value_type &a,
+          const SpaceInfo::value_type &b)
+{
+  const bool by_name = a.path.native () < b.path.native ();
+  switch (key)
+    {
+      case SortKey::Size:
+        return a.size == b.size ? by_name : a.size > b.size;
+      case SortKey::FileCount:
+        return (a.file_count == b.file_count ? by_name
+                : a.file_count > b.file_count);
+      case SortKey::Modified:
+        return a.mtime == b.mtime ? by_name : a.mtime > b.mtime;
+      default:
+        return by_name;
+    }
+}
+
+// Checks every order of `si', both ways, and that `index_of' agrees with
+// the positions.  Leaves `si' sorted by size.
+static void
+check_orders (SpaceInfo &si, const char *when)
+{
+  for (const SortKey key : KEYS)
+    for (const bool reversed : {false, true})
+      {
+        si.sort (key, reversed);
+        bool sorted = true;
+        bool indexed = true;
+        for (usize i = 1; i <= si.item_count (); ++i)
+          {
+            if (i > 1)
+              sorted &= (reversed ? in_order (key, si[i], si[i - 1])
+                                  : in_order (key, si[i - 1], si[i]));
+            indexed &= si.index_of (si[i].path) == i;
+          }
+        if (!sorted || !indexed)
+          std::fprintf (stderr, "%s: key %d%s\n", when, static_cast<int> (key),
+                        reversed ? " reversed" : "");
+        CHECK (sorted);
+        CHECK (indexed);
+      }
+  si.sort ();
+}
+
+static void
+add (SpaceInfo &si, const char *name, u64 size, u64 file_count, time_t mtime)
+{
+  struct stat sb {};
+  sb.st_mode = file_count == 1 ? S_IFREG : S_IFDIR;
+  sb.st_size = size;
+  sb.st_mtime = sb.st_atime = mtime;
+  si.add (fs::path ("/top") / name, size, file_count, file_count != 1,
+          nullptr, nullptr, &sb);
+}
+
+int
+main ()
+{
+  SpaceInfo si;
+  si.add_parent ("/");
+  add (si, "b", 300, 1, 1000);
+  add (si, "a", 300, 1, 3000);
+  add (si, "dir", 5000, 40, 2000);
+  add (si, "c", 10, 1, 500);
+  check_orders (si, "added");
+  CHECK_EQ (si.item_count (), 4U);
+  CHECK_EQ (si.total (), 5610U);
+  CHECK_EQ (si.biggest (), 5000U);
+  CHECK_EQ (si.total_file_count (), 43U);
+  // Equal sizes are sorted by name
+  CHECK (si[1].path == "dir" && si[2].path == "a" && si[3].path == "b");
+
+  // The orders are cached now, new items get inserted into them
+  add (si, "e", 400, 1, 4000);
+  add (si, "big", 9000, 2, 100);
+  check_orders (si, "inserted");
+  CHECK_EQ (si.biggest (), 9000U);
+  CHECK_EQ (si.index_of ("big"), 1U);
+  CHECK_EQ (si.index_of ("missing"), 0U);
+
+  // Changes move items within the cached orders
+  CHECK (si.update ("c", 20000, 0));
+  check_orders (si, "grown");
+  CHECK_EQ (si.index_of ("c"), 1U);
+  CHECK_EQ (si.biggest (), 20010U);
+  CHECK (si.update ("c", -20000, 0));
+  CHECK (si.set ("dir", 100, 3, false));
+  check_orders (si, "shrunk");
+  CHECK_EQ (si.biggest (), 9000U);
+  CHECK_EQ (si.total_file_count (), 9U);
+  CHECK (!si.update ("missing", 1, 1));
+  CHECK (!si.set ("missing", 1, 1, false));
+
+  struct stat sb {};
+  sb.st_mtime = sb.st_atime = 9999;
+  si.set_stat ("c", sb);
+  check_orders (si, "touched");
+  si.sort (SortKey::Modified);
+  CHECK_EQ (si.index_of ("c"), 1U);
+
+  si.remove ("big");
+  si.remove ("a");
+  si.remove ("missing");
+  check_orders (si, "removed");
+  CHECK_EQ (si.item_count (), 4U);
+  CHECK_EQ (si.index_of ("big"), 0U);
+  CHECK_EQ (si.total (), 300U + 100 + 10 + 400);
+  CHECK_EQ (si.biggest (), 400U);
+
+  // A removed name can come back
+  add (si, "a", 1, 1, 1);
+  check_orders (si, "added again");
+  CHECK_EQ (si.item_count (), 5U);
+  CHECK (si[si.index_of ("a")].size == 1);
+
+  return finish ("space_info");
+}
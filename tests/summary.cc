@@ -0,0 +1,268 @@
+// The tallies summaries are made of and what `Summary::add_file' puts into
+// them, and their encoding.
+#include "check.hh"
+#include "encoding.hh"
+#include "summary.hh"
+
+static struct stat
+file_stat (u64 size, time_t mtime, uid_t uid = 0, gid_t gid = 0)
+{
+  struct stat sb {};
+  sb.st_mode = S_IFREG;
+  sb.st_size = size;
+  sb.st_mtime = sb.st_atime = mtime;
+  sb.st_uid = uid;
+  sb.st_gid = gid;
+  return sb;
+}
+
+template <class Key>
+static std::vector<std::tuple<Key, u64, u64>>
+entries (const Tally<Key> &tally)
+{
+  std::vector<std::tuple<Key, u64, u64>> result;
+  for (const auto &e : tally)
+    result.emplace_back (e.key, e.count, e.bytes);
+  return result;
+}
+
+static void
+tallies ()
+{
+  Tally<u32> a;
+  a.add (3, 100);
+  a.add (1, 10);
+  a.add (3, 50);
+  a.add (2, 0);
+  using Entries = std::vector<std::tuple<u32, u64, u64>>;
+  // Sorted by key, equal keys add up
+  CHECK (entries (a) == (Entries {{1, 1, 10}, {2, 1, 0}, {3, 2, 150}}));
+
+  Tally<u32> b;
+  b.add (3, 25);
+  b.add (4, 5, 2);
+  a.merge (b);
+  CHECK (entries (a)
+         == (Entries {{1, 1, 10}, {2, 1, 0}, {3, 3, 175}, {4, 2, 5}}));
+
+  // Subtracting what was merged gives the same tally again, keys whose
+  // count drops to 0 go away
+  a.subtract (b);
+  CHECK (entries (a) == (Entries {{1, 1, 10}, {2, 1, 0}, {3, 2, 150}}));
+
+  // Missing keys are ignored and nothing goes below 0
+  Tally<u32> c;
+  c.add (1, 1000, 5);
+  c.add (7, 1);
+  a.subtract (c);
+  CHECK (entries (a) == (Entries {{2, 1, 0}, {3, 2, 150}}));
+
+  a.subtract (a);
+  CHECK (a.empty ());
+}
+
+static void
+extensions ()
+{
+  const u32 txt = Extension::of ("notes.txt");
+  CHECK (Extension::name (txt) == ".txt");
+  CHECK_EQ (Extension::intern (".txt"), txt);
+  // Extensions are lower case and trailing numeric ones are skipped
+  CHECK_EQ (Extension::of ("Photo.JPG"), Extension::of ("b.jpg"));
+  CHECK_EQ (Extension::of ("access.log.1"), Extension::of ("error.log"));
+  CHECK_EQ (Extension::of ("syslog.2"), Extension::NONE);
+  CHECK_EQ (Extension::of ("Makefile"), Extension::NONE);
+  CHECK_EQ (Extension::of (".bashrc"), Extension::NONE);
+  CHECK_EQ (Extension::of ("x.part-0001-of-0042-tmp"), Extension::OTHER);
+
+  Summary summary;
+  summary.add_file ("a.txt", file_stat (10, 0));
+  summary.add_file ("B.TXT", file_stat (5, 0));
+  struct stat link = file_stat (7, 0);
+  link.st_mode = S_IFLNK;
+  summary.add_file ("c.txt", link);
+  struct stat fifo = file_stat (0, 0);
+  fifo.st_mode = S_IFIFO;
+  summary.add_file ("d.txt", fifo);
+  using Entries = std::vector<std::tuple<u32, u64, u64>>;
+  CHECK (entries (summary.extensions)
+         == (Entries {{Extension::SYMLINK, 1, 7}, {Extension::OTHER, 1, 0},
+                      {txt, 2, 15}}));
+}
+
+static void
+ages ()
+{
+  constexpr time_t DAY = 24 * 60 * 60;
+  constexpr time_t NOW = 1'700'000'000;
+  Age::set_now (NOW);
+  CHECK_EQ (Age::days_since (NOW - 3 * DAY - 5), 3U);
+  // Clock skew does not make anything older
+  CHECK_EQ (Age::days_since (NOW + DAY), 0U);
+  CHECK_EQ (Age::bucket (0), 0U);
+  CHECK_EQ (Age::bucket (6), 1U);
+  CHECK_EQ (Age::bucket (7), 2U);
+  CHECK_EQ (Age::bucket (100'000), Age::BUCKETS - 1);
+  CHECK (Age::bucket_name (2) == "7-30 days");
+  CHECK (Age::bucket_name (Age::BUCKETS - 1) == "1825+ days");
+
+  // Modified long ago but read recently, which keeps it from being idle
+  struct stat read = file_stat (1000, NOW - 100 * DAY);
+  read.st_atime = NOW - 2 * DAY;
+  Summary summary;
+  summary.add_file ("read", read);
+  summary.add_file ("old", file_stat (50, NOW - 400 * DAY));
+  CHECK_EQ (summary.modified.bytes[Age::bucket (100)], 1000U);
+  CHECK_EQ (summary.accessed.bytes[Age::bucket (2)], 1000U);
+  CHECK_EQ (summary.idle.bytes[Age::bucket (2)], 1000U);
+  CHECK_EQ (summary.idle.count[Age::bucket (400)], 1U);
+
+  // Only buckets entirely past the threshold count as cold
+  CHECK_EQ (summary.idle.bytes_older_than (1), 1050U);
+  CHECK_EQ (summary.idle.bytes_older_than (3), 50U);
+  CHECK_EQ (summary.idle.bytes_older_than (365), 50U);
+  CHECK_EQ (summary.idle.bytes_older_than (366), 0U);
+
+  AgeHistogram both = summary.idle;
+  both.merge (summary.idle);
+  CHECK_EQ (both.bytes_older_than (1), 2100U);
+  both.subtract (summary.idle);
+  both.subtract (summary.idle);
+  both.subtract (summary.idle);
+  CHECK_EQ (both.bytes_older_than (0), 0U);
+}
+
+static void
+owners ()
+{
+  Summary summary;
+  summary.add_file ("a", file_stat (100, 0, 1000, 100));
+  summary.add_file ("b", file_stat (50, 0, 0, 0));
+  summary.add_file ("c", file_stat (1, 0, 1000, 0));
+  using UserEntries = std::vector<std::tuple<uid_t, u64, u64>>;
+  using GroupEntries = std::vector<std::tuple<gid_t, u64, u64>>;
+  CHECK (entries (summary.users) == (UserEntries {{0, 1, 50}, {1000, 2, 101}}));
+  CHECK (entries (summary.groups)
+         == (GroupEntries {{0, 2, 51}, {100, 1, 100}}));
+
+  // An owner whose files all went away is gone from the tally
+  Summary removed;
+  removed.add_file ("b", file_stat (50, 0, 0, 0));
+  summary.subtract (removed);
+  CHECK (entries (summary.users) == (UserEntries {{1000, 2, 101}}));
+  CHECK (entries (summary.groups)
+         == (GroupEntries {{0, 1, 1}, {100, 1, 100}}));
+}
+
+static void
+summaries ()
+{
+  Age::set_now (1'700'000'000);
+  Summary a;
+  a.add_file ("notes.txt", file_stat (100, 1'700'000'000, 1000, 100));
+  a.add_file ("syslog.2", file_stat (0, 1'600'000'000, 0, 0));
+  a.add_file ("Photo.JPG", file_stat (5'000'000, 1'690'000'000, 1000, 100));
+
+  Summary b;
+  b.add_file ("other.txt", file_stat (7, 1'699'999'000, 1001, 100));
+
+  Summary merged = a;
+  merged.merge (b);
+  CHECK_EQ (merged.users.size (), 3U);
+  merged.subtract (b);
+
+  Encoder expected;
+  a.encode (expected);
+  Encoder after_subtract;
+  merged.encode (after_subtract);
+  CHECK (after_subtract.data () == expected.data ());
+
+  // Decoding gives back the same summary
+  Decoder dec (expected.data ());
+  Summary decoded;
+  CHECK (decoded.decode (dec));
+  CHECK (dec.at_end ());
+  Encoder again;
+  decoded.encode (again);
+  CHECK (again.data () == expected.data ());
+  // Extensions are sent by name, the ids are local to the process
+  std::vector<std::string> names;
+  for (const auto &e : decoded.extensions)
+    names.push_back (Extension::name (e.key));
+  std::sort (names.begin (), names.end ());
+  CHECK (names == (std::vector<std::string> {"(none)", ".jpg", ".txt"}));
+
+  // Truncated data
+  Decoder cut (std::string_view (expected.data ()).substr (
+    0, expected.size () - 1));
+  Summary partial;
+  CHECK (!partial.decode (cut));
+}
+
+static void
+out_of_range_size_bucket ()
+{
+  Encoder enc;
+  // No extensions and empty age histograms
+  enc.uint (0);
+  for (usize i = 0; i < 3 * 2 * Age::BUCKETS; ++i)
+    enc.uint (0);
+  // No users or groups, then a size bucket past the last one
+  enc.uint (0);
+  enc.uint (0);
+  enc.uint (1);
+  enc.uint (FileSize::BUCKETS);
+  enc.uint (1);
+  enc.uint (1);
+  for (int i = 0; i < 4; ++i)
+    enc.uint (0);
+  Decoder dec (enc.data ());
+  Summary summary;
+  CHECK (!summary.decode (dec));
+}
+
+static void
+sizes ()
+{
+  CHECK_EQ (FileSize::bucket (0), 0);
+  CHECK_EQ (FileSize::bucket (1), 1);
+  CHECK_EQ (FileSize::bucket (3), 2);
+  CHECK_EQ (FileSize::bucket (4), 3);
+  CHECK_EQ (FileSize::bucket (3000), 12);
+  CHECK_EQ (FileSize::bucket (~0ULL), FileSize::BUCKETS - 1);
+  CHECK_EQ (FileSize::bucket_min (11), 1024U);
+  CHECK_EQ (FileSize::bucket_name (0), "empty");
+  CHECK_EQ (FileSize::bucket_name (1), "1-2");
+  CHECK_EQ (FileSize::bucket_name (11), "1K-2K");
+  CHECK_EQ (FileSize::bucket_name (FileSize::BUCKETS - 1), "1T+");
+
+  Summary summary;
+  summary.add_file ("a", file_stat (0, 0));
+  summary.add_file ("b", file_stat (3000, 0));
+  summary.add_file ("c", file_stat (2500, 0));
+  summary.add_file ("d", file_stat (1, 0));
+  CHECK (entries (summary.sizes)
+         == (std::vector<std::tuple<u8, u64, u64>> {
+           {0, 1, 0}, {1, 1, 1}, {12, 2, 5500}}));
+
+  // The tally goes through the encoding unchanged
+  Encoder enc;
+  summary.encode (enc);
+  Decoder dec (enc.data ());
+  Summary decoded;
+  CHECK (decoded.decode (dec));
+  CHECK (entries (decoded.sizes) == entries (summary.sizes));
+}
+
+int
+main ()
+{
+  tallies ();
+  extensions ();
+  ages ();
+  owners ();
+  summaries ();
+  out_of_range_size_bucket ();
+  sizes ();
+  return finish ("summary");
+}